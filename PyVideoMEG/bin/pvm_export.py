@@ -30,11 +30,7 @@ import tempfile
 import shutil
 import numpy
 
-from PIL import Image, ImageDraw, ImageFont
-try:
-    from BytesIO import BytesIO
-except ImportError:
-    from io import BytesIO
+from PIL import ImageDraw, ImageFont
 
 import pyvideomeg
 
@@ -58,7 +54,7 @@ fnt = ImageFont.truetype(FONT_FILE, FONT_SZ)
 vid_file = pyvideomeg.VideoData(sys.argv[1])
 
 for i in range(len(vid_file.ts)):
-    img = Image.open(BytesIO(vid_file.get_frame(i)))
+    img = vid_file.get_image(i)
     draw = ImageDraw.Draw(img)
     draw.text((10,0), '%i  :  %s' % (vid_file.ts[i], pyvideomeg.ts2str(vid_file.ts[i])), font=fnt, fill='black')
     img.save('%s/%08i.jpg' % (tmp_fldr, i))
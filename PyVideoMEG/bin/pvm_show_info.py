@@ -24,6 +24,10 @@ import sys
 
 import pyvideomeg
 
+_CODEC_NAMES = {pyvideomeg.CODEC_JPEG: 'JPEG',
+                pyvideomeg.CODEC_ZSTD: 'zstd (lossless)',
+                pyvideomeg.CODEC_LZ4: 'LZ4 (lossless)'}
+
 try:
     vf = pyvideomeg.VideoData(sys.argv[1])
     is_audio = False
@@ -57,6 +61,9 @@ if is_audio:
     print('\tFirst buffer time: %s' % pyvideomeg.ts2str(af.ts[0]))
     print('\tLast buffer time: %s' % pyvideomeg.ts2str(af.ts[-1]))
     
+    if af.ver in (2, 3):
+        print('\tMissing buffers: %i' % pyvideomeg.count_missing_blocks(af.block_ids))
+    
     if af.ver == 3:
         print('\tSite ID: %i' % af.site_id)
         
@@ -73,12 +80,16 @@ else:
     print('\n\n\n')
     print('Video file.')
     print('\tVersion: %i' % vf.ver)
+    print('\tCodec: %s' % _CODEC_NAMES.get(vf.codec, 'unknown (%i)' % vf.codec))
     print('\tNumber of frames: %i' % len(vf.ts))
     print('\tFPS: %f' % fps)
     print('\tTotal duration (estimated): %f seconds' % (len(vf.ts) / fps))
     print('\tFirst frame time: %s' % pyvideomeg.ts2str(vf.ts[0]))
     print('\tLast frame time: %s' % pyvideomeg.ts2str(vf.ts[-1]))
     
+    if vf.ver in (2, 3, 5):
+        print('\tMissing frames: %i' % pyvideomeg.count_missing_blocks(vf.block_ids))
+    
     if vf.ver == 3:
         print('\tSite ID: %i' % vf.site_id)
         
@@ -17,6 +17,7 @@
 """
 
 from .read_data import (AudioData, VideoData, UnknownVersionError, ts2str,
-                        repair_file, EvlData, Event, FifData)
+                        repair_file, EvlData, Event, FifData, CODEC_JPEG,
+                        CODEC_ZSTD, CODEC_LZ4, count_missing_blocks)
 from .video_writer import OverWriteError, VideoFile
 from .comp_tstamps import comp_tstamps
@@ -18,12 +18,33 @@
 import struct
 import time
 import math
+from io import BytesIO
 import numpy
 
 _BYTES_PER_SAMPLE = 2   # for the audio data
 _DECODING_FORMAT = 'h'  # for the audio data
 _REGR_SEGM_LENGTH = 20  # seconds, should be integer
 
+# Codecs of the video chunks, stored in the header of version 4 and 5 video
+# files
+CODEC_JPEG = 0
+CODEC_ZSTD = 1
+CODEC_LZ4 = 2
+
+# Pixel formats of the losslessly compressed frames
+PIXEL_FORMAT_MONO8 = 0
+PIXEL_FORMAT_RGB8 = 1
+PIXEL_FORMAT_YUV422 = 2
+PIXEL_FORMAT_YUV411 = 3
+
+_LOSSLESS_FILTER_UP = 1
+
+# Index written by the recording software next to the data files
+INDEX_FILE_EXT = '.idx'
+_INDEX_MAGIC = b'ELEKTA_INDEX_FILE'
+_INDEX_ENTRIES = {1: numpy.dtype([('ts', '<u8'), ('offset', '<u8'), ('size', '<u8')]),
+                  2: numpy.dtype([('ts', '<u8'), ('block_id', '<u8'), ('offset', '<u8'), ('size', '<u8')])}
+
 class UnknownVersionError(Exception):
     pass
 
@@ -32,7 +53,7 @@ def _read_attrib(data_file, ver):
     Read data block attributes. If cannot read the attributes (EOF?), return
     -1 in ts
     """
-    if ver == 1:
+    if ver == 1 or ver == 4:
         attrib = data_file.read(12)
         if len(attrib) == 12:
             ts, sz = struct.unpack('QI', attrib)
@@ -42,7 +63,7 @@ def _read_attrib(data_file, ver):
         block_id = 0
         total_sz = sz + 12
         
-    elif ver == 2 or ver == 3:
+    elif ver == 2 or ver == 3 or ver == 5:
         attrib = data_file.read(20)
         if len(attrib) == 20:
             ts, block_id, sz = struct.unpack('QQI', attrib)
@@ -58,6 +79,120 @@ def _read_attrib(data_file, ver):
     return ts, block_id, sz, total_sz
     
     
+def _read_index(file_name, end_data):
+    """
+    Read the index file of the data file file_name. Return a numpy array of
+    index entries (ts, block_id, offset, size; version 1 indices have no
+    block_id) pointing inside the first end_data bytes of the data file, or
+    None if there is no usable index.
+    """
+    try:
+        index_file = open(file_name + INDEX_FILE_EXT, 'rb')
+    except IOError:
+        return None
+
+    with index_file:
+        if index_file.read(len(_INDEX_MAGIC)) != _INDEX_MAGIC:
+            return None
+        ver = index_file.read(4)
+        if len(ver) != 4 or struct.unpack('I', ver)[0] not in _INDEX_ENTRIES:
+            return None
+        entry = _INDEX_ENTRIES[struct.unpack('I', ver)[0]]
+        buf = index_file.read()
+
+    # The index can end with a partial entry or run ahead of the data file if
+    # the recording was interrupted
+    entries = numpy.frombuffer(buf[:len(buf) - len(buf) % entry.itemsize], dtype=entry)
+    return entries[entries['offset'] + entries['size'] <= end_data]
+
+
+def count_missing_blocks(block_ids):
+    """
+    Return the number of chunks missing from a file, judging by the gaps in
+    the (consecutive as produced) block IDs of its chunks.
+    """
+    steps = numpy.diff(numpy.asarray(block_ids, dtype=numpy.int64))
+    return int(numpy.sum(steps[steps > 1] - 1))
+
+
+def _raw_row_size(pixel_format, width):
+    """
+    Return the size of a row of pixels in bytes.
+    """
+    if pixel_format == PIXEL_FORMAT_RGB8:
+        return width * 3
+    elif pixel_format == PIXEL_FORMAT_YUV422:
+        return width * 2
+    elif pixel_format == PIXEL_FORMAT_YUV411:
+        return width * 3 // 2
+    else:
+        return width
+
+
+def decode_lossless_frame(data, codec):
+    """
+    Decompress a lossless (zstd or LZ4) video frame. Return a tuple
+    (pixel_format, frame). frame is a height-by-width numpy array for
+    monochrome frames, height-by-width-by-3 for RGB and height-by-row_size
+    (interleaved IIDC byte order) for YUV frames. Requires the zstandard or
+    lz4 package, respectively.
+    """
+    width, height, pixel_format, row_filter, n_bands = struct.unpack('HHBBH', data[0:8])
+    assert(row_filter == _LOSSLESS_FILTER_UP)
+    band_sizes = struct.unpack('%iI' % n_bands, data[8:8+4*n_bands])
+
+    row_size = _raw_row_size(pixel_format, width)
+    rows_per_band = (height + n_bands - 1) // n_bands
+
+    if codec == CODEC_ZSTD:
+        import zstandard
+        decompressor = zstandard.ZstdDecompressor()
+        decompress = lambda buf, raw_sz: decompressor.decompress(buf, max_output_size=raw_sz)
+    elif codec == CODEC_LZ4:
+        import lz4.block
+        decompress = lambda buf, raw_sz: lz4.block.decompress(buf, uncompressed_size=raw_sz)
+    else:
+        raise ValueError('Not a lossless codec: %i' % codec)
+
+    bands = []
+    offset = 8 + 4*n_bands
+    for i in range(n_bands):
+        n_rows = min(rows_per_band, height - i*rows_per_band)
+        raw = decompress(bytes(data[offset:offset+band_sizes[i]]), n_rows * row_size)
+        band = numpy.frombuffer(raw, dtype=numpy.uint8).reshape((n_rows, row_size))
+        bands.append(numpy.cumsum(band, axis=0, dtype=numpy.uint8))    # undo the up filter
+        offset += band_sizes[i]
+
+    frame = numpy.concatenate(bands)
+    if pixel_format == PIXEL_FORMAT_RGB8:
+        frame = frame.reshape((height, width, 3))
+
+    return pixel_format, frame
+
+
+def _yuv_to_rgb(pixel_format, frame):
+    """
+    Convert a decoded YUV 4:2:2 (UYVY) or 4:1:1 (UYYVYY) frame to a
+    height-by-width-by-3 RGB array (ITU-R BT.601, same arithmetic as the
+    recording program's preview).
+    """
+    if pixel_format == PIXEL_FORMAT_YUV422:
+        group_sz, y_indx, v_indx = 4, [1, 3], 2
+    else:
+        group_sz, y_indx, v_indx = 6, [1, 2, 4, 5], 3
+
+    height = frame.shape[0]
+    groups = frame.reshape((height, -1, group_sz)).astype(numpy.int32)
+    u = groups[:, :, 0:1] - 128
+    v = groups[:, :, v_indx:v_indx+1] - 128
+    y = groups[:, :, y_indx]
+
+    rgb = numpy.stack((y + ((359 * v) >> 8),
+                       y - ((88 * u + 183 * v) >> 8),
+                       y + ((454 * u) >> 8)), axis=-1)
+    return numpy.clip(rgb, 0, 255).astype(numpy.uint8).reshape((height, -1, 3))
+
+
 def ts2str(ts):
     """
     Convert timestamp to human-readable string. Slightly differs from the
@@ -89,13 +224,17 @@ def repair_file(file_name, fixed_file_name):
     
     # Read the file version
     ver = struct.unpack('I', inp_file.read(4))[0]
-    if ver < 1 or ver > 3:
+    if ver < 1 or ver > 5:
         raise UnknownVersionError()        
         
     if ver == 3:
         # Read site_id and is_sender data
         id_sender_data = inp_file.read(2)
         assert(len(id_sender_data) == 2)
+
+    if ver == 4 or ver == 5:
+        codec_data = inp_file.read(4)
+        assert(len(codec_data) == 4)
         
     if is_audio:
         srate_nchan_data = inp_file.read(8)
@@ -130,6 +269,9 @@ def repair_file(file_name, fixed_file_name):
     
     if ver == 3:
         out_file.write(id_sender_data)
+
+    if ver == 4 or ver == 5:
+        out_file.write(codec_data)
         
     if is_audio:
         out_file.write(srate_nchan_data)
@@ -166,6 +308,7 @@ class AudioData:
         srate     - nominal sampling rate
         nchan     - number of channels
         ts        - buffers' timestamps
+        block_ids - buffers' block IDs (0 for version 1 files)
         raw_audio - raw audio data
         buf_sz    - buffer size (bytes)
     """
@@ -200,12 +343,14 @@ class AudioData:
         n_chunks = (end_data - begin_data) // total_sz        
         self.raw_audio = bytearray(n_chunks * self.buf_sz)
         self.ts = numpy.zeros(n_chunks)
+        self.block_ids = numpy.zeros(n_chunks, dtype=numpy.uint64)
 
         for i in range(n_chunks):
             ts, block_id, sz, cur_total_sz = _read_attrib(data_file, self.ver)
             assert(cur_total_sz == total_sz)
             self.raw_audio[self.buf_sz*i : self.buf_sz*(i+1)] = data_file.read(sz)
             self.ts[i] = ts
+            self.block_ids[i] = block_id
 
         data_file.close()
         
@@ -259,12 +404,20 @@ class VideoData:
     """
     To read a video file initialize VideoData object with file name. You can
     then get the frame times from the object's ts variable. To get individual
-    frames use get_frame function.
+    frames use get_frame function (or get_image for a PIL image), find_frame finds the frame shown at a
+    given time. The codec of the frames is stored in the object's codec
+    variable (CODEC_JPEG, CODEC_ZSTD or CODEC_LZ4) and the frames' block IDs
+    in block_ids (0 for version 1 and 4 files).
+
+    If the file has an index (file name + INDEX_FILE_EXT), the frames are
+    located from the index instead of scanning the whole file; only the part
+    of the file not covered by the index is scanned.
     """
     def __init__(self, file_name):
         self._file = open(file_name, 'rb')
         assert(self._file.read(len('ELEKTA_VIDEO_FILE')) == b'ELEKTA_VIDEO_FILE')  # make sure the magic string is OK 
         self.ver = struct.unpack('I', self._file.read(4))[0]
+        self.codec = CODEC_JPEG
         
         if self.ver == 1 or self.ver == 2:        
             self.site_id = -1
@@ -272,6 +425,11 @@ class VideoData:
 
         elif self.ver == 3:
             self.site_id, self.is_sender = struct.unpack('BB', self._file.read(2))
+
+        elif self.ver == 4 or self.ver == 5:
+            self.site_id = -1
+            self.is_sender = -1
+            self.codec = struct.unpack('I', self._file.read(4))[0]
             
         else:
             raise UnknownVersionError()
@@ -282,17 +440,31 @@ class VideoData:
         end_data = self._file.tell()
         self._file.seek(begin_data, 0)
 
-        self.ts = numpy.array([])
+        ts_list = []
+        block_id_list = []
         self._frame_ptrs = []
 
+        index = _read_index(file_name, end_data)
+        if index is not None and len(index) > 0:
+            ts_list = index['ts'].tolist()
+            if 'block_id' in index.dtype.names:
+                block_id_list = index['block_id'].tolist()
+            else:
+                block_id_list = [0] * len(index)
+            self._frame_ptrs = list(zip(index['offset'].tolist(), index['size'].tolist()))
+            self._file.seek(int(index['offset'][-1] + index['size'][-1]), 0)
+
         while self._file.tell() < end_data:     # we did not reach end of file
             ts, block_id, sz, total_sz = _read_attrib(self._file, self.ver)
             assert(ts != -1)
-            self.ts = numpy.append(self.ts, ts)
+            ts_list.append(ts)
+            block_id_list.append(block_id)
             self._frame_ptrs.append((self._file.tell(), sz))
             assert(self._file.tell() + sz <= end_data)
             self._file.seek(sz, 1)
-            
+
+        self.ts = numpy.array(ts_list, dtype=float)
+        self.block_ids = numpy.array(block_id_list, dtype=numpy.uint64)
         self.nframes = self.ts.size
             
     def __del__(self):
@@ -300,11 +472,44 @@ class VideoData:
         
     def get_frame(self, indx):
         """
-        Return indx-th frame a jpg image in the memory.
+        Return indx-th frame a jpg image in the memory. For lossless video
+        return the decompressed frame (see decode_lossless_frame) instead.
+        """
+        offset, sz = self._frame_ptrs[indx]
+        self._file.seek(offset)
+        if self.codec == CODEC_JPEG:
+            return(self._file.read(sz))
+        else:
+            return(decode_lossless_frame(self._file.read(sz), self.codec)[1])
+
+    def get_image(self, indx):
+        """
+        Return indx-th frame as a PIL image regardless of the codec: the jpg
+        image for JPEG video, a grayscale or RGB image for lossless video.
+        Requires PIL.
         """
+        from PIL import Image
+
         offset, sz = self._frame_ptrs[indx]
         self._file.seek(offset)
-        return(self._file.read(sz))
+        data = self._file.read(sz)
+        if self.codec == CODEC_JPEG:
+            return(Image.open(BytesIO(data)))
+
+        pixel_format, frame = decode_lossless_frame(data, self.codec)
+        if pixel_format == PIXEL_FORMAT_MONO8:
+            return(Image.fromarray(frame, 'L'))
+        elif pixel_format == PIXEL_FORMAT_RGB8:
+            return(Image.fromarray(frame, 'RGB'))
+        else:
+            return(Image.fromarray(_yuv_to_rgb(pixel_format, frame), 'RGB'))
+
+    def find_frame(self, ts):
+        """
+        Return the index of the last frame with timestamp not later than ts,
+        or -1 if all the frames are later.
+        """
+        return int(numpy.searchsorted(self.ts, ts, side='right')) - 1
         
 
 class EvlData:
@@ -21,7 +21,7 @@ from __future__ import print_function
 from os import path
 import struct
 import numpy
-from .read_data import UnknownVersionError
+from .read_data import UnknownVersionError, CODEC_JPEG
 
 __author__ = "Janne Holopainen"
 
@@ -37,10 +37,12 @@ class OverWriteError(Exception):
 
 class VideoFile(object):
     """
-    .Video.dat file
+    .Video.dat file. For version 4 and 5 files codec (CODEC_JPEG, CODEC_ZSTD
+    or CODEC_LZ4) is stored in the header; the frames are appended as they are,
+    already compressed.
     """
 
-    def __init__(self, file_name, ver, site_id=None, is_sender=None):
+    def __init__(self, file_name, ver, site_id=None, is_sender=None, codec=CODEC_JPEG):
         if path.isfile(file_name):
             self._file = None
             raise OverWriteError("Won't allow overwriting. File exists on path:\n" +
@@ -59,8 +61,15 @@ class VideoFile(object):
                 self._file.write(struct.pack('B', 0) if site_id is None else struct.pack('B', 1))
                 self._file.write(struct.pack('B', 0) if is_sender is None else struct.pack('B', 1))
                 self.ver = ver
+            elif ver == 4 or ver == 5:
+                self._file.write(struct.pack('II', ver, codec))
+                self.site_id = -1
+                self.is_sender = -1
+                self.ver = ver
             else:
-                raise UnknownVersionError("Supported version numbers are: 1,2,3")
+                raise UnknownVersionError("Supported version numbers are: 1,2,3,4,5")
+
+            self.codec = codec
 
             self.timestamps = numpy.array([])
             self._frame_ptrs = []
@@ -70,18 +79,23 @@ class VideoFile(object):
         if self._file is not None:
             self._file.close()
 
-    def append_frame(self, timestamp, frame):
+    def append_frame(self, timestamp, frame, block_id=None):
         """
-        Appends a frame to the end of the file.
+        Appends a frame to the end of the file. For the versions storing block
+        IDs (2, 3 and 5) the frames are numbered consecutively unless block_id
+        is given.
         """
+        if block_id is None:
+            block_id = self._nframes
+
         self._file.seek(0, 2)
 
-        if self.ver == 1:
+        if self.ver in [1, 4]:
             self._file.write(struct.pack('QI', timestamp, len(frame)))
-        elif self.ver in [2, 3]:
-            self._file.write(struct.pack('QQI', timestamp, self._nframes, len(frame)))
+        elif self.ver in [2, 3, 5]:
+            self._file.write(struct.pack('QQI', timestamp, block_id, len(frame)))
         else:
-            raise UnknownVersionError("Supported version numbers are: 1,2,3")
+            raise UnknownVersionError("Supported version numbers are: 1,2,3,4,5")
 
         self._frame_ptrs.append((self._file.tell(), len(frame)))
         self._file.write(frame)
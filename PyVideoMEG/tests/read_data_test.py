@@ -1,7 +1,16 @@
 import unittest
+import struct
+import tempfile
+import os
 from os import path as op
+import numpy
 from pyvideomeg import read_data
 
+try:
+    import zstandard
+except ImportError:
+    zstandard = None
+
 
 class TestFifReader(unittest.TestCase):
 
@@ -37,6 +46,136 @@ class TestEvlReader(unittest.TestCase):
     def tearDown(self):
         pass
 
+class _VideoFileTestCase(unittest.TestCase):
+    """
+    Base for the tests reading a video file written to a temporary file.
+    """
+    def setUp(self):
+        fd, self.fname = tempfile.mkstemp(suffix='.vid')
+        os.close(fd)
+
+    def _write_file(self, header, chunk_fmt, chunks):
+        """
+        Write the video file: header follows the magic string, each chunk is
+        a tuple of the attributes preceding the size in chunk_fmt followed by
+        the data. Return the offsets of the chunks' data.
+        """
+        offsets = []
+        with open(self.fname, 'wb') as f:
+            f.write(b'ELEKTA_VIDEO_FILE')
+            f.write(header)
+            for chunk in chunks:
+                f.write(struct.pack(chunk_fmt, *(tuple(chunk[:-1]) + (len(chunk[-1]),))))
+                offsets.append(f.tell())
+                f.write(chunk[-1])
+        return offsets
+
+    def _write_index(self, ver, entry_fmt, entries, tail=b''):
+        """
+        Write the index of the video file, followed by tail.
+        """
+        with open(self.fname + read_data.INDEX_FILE_EXT, 'wb') as f:
+            f.write(b'ELEKTA_INDEX_FILE')
+            f.write(struct.pack('I', ver))
+            for entry in entries:
+                f.write(struct.pack(entry_fmt, *entry))
+            f.write(tail)
+
+    def tearDown(self):
+        for fname in (self.fname, self.fname + read_data.INDEX_FILE_EXT):
+            if op.exists(fname):
+                os.remove(fname)
+
+class TestLosslessVideoReader(_VideoFileTestCase):
+    def setUp(self):
+        _VideoFileTestCase.setUp(self)
+        # 2 bands, second one shorter than the first
+        self.frame = (numpy.arange(5*6).reshape((5, 6)) * 7 % 256).astype(numpy.uint8)
+
+    def _write_file(self, chunks):
+        _VideoFileTestCase._write_file(self, struct.pack('II', 4, read_data.CODEC_ZSTD), 'QI', chunks)
+
+    def _compress_frame(self):
+        bands = [self.frame[0:3], self.frame[3:5]]
+        compressed = []
+        for band in bands:
+            filtered = band.copy()
+            filtered[1:] = band[1:] - band[:-1]
+            compressed.append(zstandard.ZstdCompressor().compress(filtered.tobytes()))
+        header = struct.pack('HHBBH', 6, 5, read_data.PIXEL_FORMAT_MONO8, 1, len(bands))
+        header += struct.pack('%iI' % len(bands), *[len(c) for c in compressed])
+        return header + b''.join(compressed)
+
+    def test_header(self):
+        self._write_file([(1000, b'abc'), (1033, b'defg')])
+        data = read_data.VideoData(self.fname)
+        self.assertEqual(data.codec, read_data.CODEC_ZSTD)
+        self.assertEqual(data.nframes, 2)
+        self.assertEqual(list(data.ts), [1000, 1033])
+
+    @unittest.skipUnless(zstandard, 'zstandard is not installed')
+    def test_decode(self):
+        self._write_file([(1000, self._compress_frame())])
+        data = read_data.VideoData(self.fname)
+        numpy.testing.assert_array_equal(data.get_frame(0), self.frame)
+
+class TestVideoIndex(_VideoFileTestCase):
+    def setUp(self):
+        _VideoFileTestCase.setUp(self)
+        self.chunks = [(1000 + 33*i, bytes(bytearray([i]) * (10 + i))) for i in range(5)]
+        offsets = self._write_file(struct.pack('I', 1), 'QI', self.chunks)
+
+        # Index of the first three chunks followed by a partial entry, as
+        # left by an interrupted recording
+        entries = [(ts, offset, len(data)) for (ts, data), offset in zip(self.chunks, offsets)]
+        self._write_index(1, 'QQQ', entries[:3], struct.pack('QQ', 0, 0))
+
+    def test_index(self):
+        data = read_data.VideoData(self.fname)
+        self.assertEqual(data.nframes, len(self.chunks))
+        self.assertEqual(list(data.ts), [ts for ts, chunk in self.chunks])
+        for i, (ts, chunk) in enumerate(self.chunks):
+            self.assertEqual(data.get_frame(i), chunk)
+
+    def test_find_frame(self):
+        data = read_data.VideoData(self.fname)
+        self.assertEqual(data.find_frame(999), -1)
+        self.assertEqual(data.find_frame(1000), 0)
+        self.assertEqual(data.find_frame(1070), 2)
+        self.assertEqual(data.find_frame(5000), 4)
+
+    def test_block_ids(self):
+        # Version 5 file with chunk 3 missing
+        self._write_file(struct.pack('II', 5, read_data.CODEC_LZ4), 'QQI',
+                         [(1000 + 33*block_id, block_id, b'abc') for block_id in (1, 2, 4, 5)])
+        os.remove(self.fname + read_data.INDEX_FILE_EXT)
+
+        data = read_data.VideoData(self.fname)
+        self.assertEqual(data.codec, read_data.CODEC_LZ4)
+        self.assertEqual(list(data.block_ids), [1, 2, 4, 5])
+        self.assertEqual(list(data.ts), [1033, 1066, 1132, 1165])
+        self.assertEqual(read_data.count_missing_blocks(data.block_ids), 1)
+
+    def test_index_block_ids(self):
+        # Version 2 file with chunks 2, 6 and 7 missing and a version 2 index
+        # of the first four chunks
+        block_ids = [0, 1, 3, 4, 5, 8]
+        chunks = [(1000 + 33*block_id, block_id, bytes(bytearray([block_id]) * 3)) for block_id in block_ids]
+        offsets = self._write_file(struct.pack('I', 2), 'QQI', chunks)
+        entries = [(ts, block_id, offset, len(data)) for (ts, block_id, data), offset in zip(chunks, offsets)]
+        self._write_index(2, 'QQQQ', entries[:4], struct.pack('QQ', 0, 0))
+
+        data = read_data.VideoData(self.fname)
+        self.assertEqual(data.nframes, len(chunks))
+        self.assertEqual(list(data.block_ids), block_ids)
+        self.assertEqual(read_data.count_missing_blocks(data.block_ids), 3)
+        self.assertEqual(data.find_frame(1066), 1)
+        self.assertEqual(data.find_frame(1100), 2)
+        self.assertEqual(data.find_frame(1200), 4)
+        self.assertEqual(data.find_frame(1264), 5)
+        for i, (ts, block_id, chunk) in enumerate(chunks):
+            self.assertEqual(data.get_frame(i), chunk)
+
 
 if __name__ == '__main__':
     unittest.main()
@@ -18,10 +18,26 @@ TARGET = VideoRecStation
 QT += core \
     gui \
     widgets
+CONFIG += c++11
 HEADERS += settings.h \
     videodialog.h \
     filewriter.h \
     videocompressorthread.h \
+    frameencoder.h \
+    jpegencoder.h \
+    paralleljpegencoder.h \
+    slicerunner.h \
+    losslessencoder.h \
+    losslessdecoder.h \
+    pixelformat.h \
+    turbojpegencoder.h \
+    compressorpool.h \
+    bufferarena.h \
+    bufferstats.h \
+    recordingepoch.h \
+    ioengine.h \
+    directfile.h \
+    ratecontroller.h \
     stoppablethread.h \
     speakerthread.h \
     nonblockingbuffer.h \
@@ -38,6 +54,20 @@ SOURCES += settings.cpp \
     videodialog.cpp \
     filewriter.cpp \
     videocompressorthread.cpp \
+    frameencoder.cpp \
+    jpegencoder.cpp \
+    paralleljpegencoder.cpp \
+    slicerunner.cpp \
+    losslessencoder.cpp \
+    losslessdecoder.cpp \
+    turbojpegencoder.cpp \
+    compressorpool.cpp \
+    bufferarena.cpp \
+    bufferstats.cpp \
+    recordingepoch.cpp \
+    ioengine.cpp \
+    directfile.cpp \
+    ratecontroller.cpp \
     stoppablethread.cpp \
     speakerthread.cpp \
     nonblockingbuffer.cpp \
@@ -61,3 +91,30 @@ LIBS += -L/usr/local/lib \
     -ljpeg
 RESOURCES += 
 DEFINES += __STDC_LIMIT_MACROS
+
+# Optional TurboJPEG encoder backend (selected at run time in the settings)
+packagesExist(libturbojpeg) {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += libturbojpeg
+    DEFINES += HAVE_TURBOJPEG
+}
+
+# Optional lossless video codecs (selected at run time in the settings)
+packagesExist(libzstd) {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += libzstd
+    DEFINES += HAVE_ZSTD
+}
+packagesExist(liblz4) {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += liblz4
+    DEFINES += HAVE_LZ4
+}
+
+# Optional io_uring support for the shared I/O engine (selected at run time in
+# the settings)
+packagesExist(liburing) {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += liburing
+    DEFINES += HAVE_LIBURING
+}
@@ -0,0 +1,181 @@
+/*
+ * bufferarena.cpp
+ *
+ * Author: Andrey Zhdanov
+ * Copyright (C) 2014 BioMag Laboratory, Helsinki University Central Hospital
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <iostream>
+#include <algorithm>
+
+#include "config.h"
+#include "bufferarena.h"
+#include "cycdatabuffer.h"
+
+using namespace std;
+
+
+BufferArena::BufferArena(uint64_t _size, bool _hugePages, bool _lockMemory)
+{
+    hugePages = _hugePages;
+    lockMemory = _lockMemory;
+    memFd = -1;
+
+    // Allocating the pages with fallocate() fails right away if not enough
+    // huge pages are reserved in the system
+    if (_hugePages)
+    {
+        pageSize = HUGE_PAGE_SIZE;
+        size = (_size + pageSize - 1) / pageSize * pageSize;
+        memFd = memfd_create("bufferarena", MFD_CLOEXEC | MFD_HUGETLB);
+        if (memFd >= 0 && (ftruncate(memFd, size) || fallocate(memFd, 0, 0, size)))
+        {
+            close(memFd);
+            memFd = -1;
+        }
+
+        if (memFd < 0)
+        {
+            clog << "Not enough huge pages available for buffer arena, using transparent huge pages" << endl;
+        }
+    }
+
+    if (memFd < 0)
+    {
+        pageSize = sysconf(_SC_PAGESIZE);
+        size = (_size + pageSize - 1) / pageSize * pageSize;
+        memFd = memfd_create("bufferarena", MFD_CLOEXEC);
+        if (memFd < 0 || ftruncate(memFd, size) || fallocate(memFd, 0, 0, size))
+        {
+            cerr << "Cannot allocate memory for buffer arena" << endl;
+            abort();
+        }
+    }
+
+    freeSlices[0] = size;
+    clog << "Buffer arena of " << size / (1024 * 1024) << " MB allocated" << endl;
+}
+
+
+BufferArena::~BufferArena()
+{
+    close(memFd);
+}
+
+
+bool BufferArena::allocate(uint64_t* _size, uint64_t* _offset)
+{
+    QMutexLocker    locker(&mutex);
+    uint64_t        sliceSize = (*_size + pageSize - 1) / pageSize * pageSize;
+
+    // First fit
+    for (map<uint64_t, uint64_t>::iterator it = freeSlices.begin(); it != freeSlices.end(); it++)
+    {
+        if (it->second < sliceSize)
+        {
+            continue;
+        }
+
+        *_offset = it->first;
+        *_size = sliceSize;
+        if (it->second > sliceSize)
+        {
+            freeSlices[it->first + sliceSize] = it->second - sliceSize;
+        }
+        freeSlices.erase(it);
+        return(true);
+    }
+
+    return(false);
+}
+
+
+void BufferArena::release(uint64_t _offset, uint64_t _size)
+{
+    QMutexLocker                        locker(&mutex);
+    map<uint64_t, uint64_t>::iterator   next;
+    map<uint64_t, uint64_t>::iterator   prev;
+
+    // Merge with the neighbouring free slices
+    next = freeSlices.lower_bound(_offset);
+    if (next != freeSlices.end() && _offset + _size == next->first)
+    {
+        _size += next->second;
+        freeSlices.erase(next++);
+    }
+    if (next != freeSlices.begin())
+    {
+        prev = next;
+        prev--;
+        if (prev->first + prev->second == _offset)
+        {
+            prev->second += _size;
+            return;
+        }
+    }
+
+    freeSlices[_offset] = _size;
+}
+
+
+int BufferArena::fd()
+{
+    return(memFd);
+}
+
+
+uint64_t BufferArena::granularity()
+{
+    return(pageSize);
+}
+
+
+bool BufferArena::isHugePages()
+{
+    return(hugePages);
+}
+
+
+bool BufferArena::isLockMemory()
+{
+    return(lockMemory);
+}
+
+
+uint64_t BufferArena::freeSpace()
+{
+    QMutexLocker    locker(&mutex);
+    uint64_t        res = 0;
+
+    for (map<uint64_t, uint64_t>::iterator it = freeSlices.begin(); it != freeSlices.end(); it++)
+    {
+        res += it->second;
+    }
+
+    return(res);
+}
+
+
+uint64_t BufferArena::ringSize(double _bytesPerSec, int _maxChunkSize, double _latency)
+{
+    uint64_t    minSize = uint64_t(MIN_BUFFER_CHUNKS) * (_maxChunkSize + CycDataBuffer::chunkOverhead());
+
+    return(max(uint64_t(_bytesPerSec * _latency), minSize));
+}
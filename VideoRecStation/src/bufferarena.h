@@ -0,0 +1,92 @@
+/*
+ * bufferarena.h
+ *
+ * Author: Andrey Zhdanov
+ * Copyright (C) 2014 BioMag Laboratory, Helsinki University Central Hospital
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BUFFERARENA_H_
+#define BUFFERARENA_H_
+
+#include <stdint.h>
+#include <map>
+#include <QMutex>
+
+//! Memory shared by the circular buffers of all the streams.
+/*!
+ * The arena is a single anonymous memory file allocated (and prefaulted)
+ * once. Circular buffers created with the arena map slices of it (see
+ * CycDataBuffer) and give them back when destroyed, so the memory of a
+ * camera that is switched off can be reused by the next camera switched
+ * on. Slices are multiples of granularity() bytes.
+ *
+ * The buffers are meant to be sized by the data rate of their stream times
+ * the latency the stream should be able to absorb, see ringSize().
+ */
+class BufferArena
+{
+public:
+    /*!
+     * _size is in bytes. If _hugePages is true, the arena is backed by
+     * explicit (hugetlbfs) huge pages if enough of them are reserved in the
+     * system, and by transparent huge pages otherwise. If _lockMemory is
+     * true, the buffers mapping the arena are locked in RAM.
+     */
+    BufferArena(uint64_t _size, bool _hugePages=false, bool _lockMemory=false);
+    virtual ~BufferArena();
+
+    /*!
+     * Take a slice of at least *_size bytes from the arena. On success
+     * *_size is set to the actual (rounded up) size of the slice and
+     * *_offset to its offset in the memory file. Return false if there is
+     * no large enough free slice.
+     */
+    bool allocate(uint64_t* _size, uint64_t* _offset);
+
+    //! Give back a slice obtained with allocate().
+    void release(uint64_t _offset, uint64_t _size);
+
+    //! Memory file holding the arena.
+    int fd();
+
+    //! Alignment and size granularity of the slices in bytes.
+    uint64_t granularity();
+
+    //! Settings the arena was created with (see the constructor).
+    bool isHugePages();
+    bool isLockMemory();
+
+    //! Total size of the free slices in bytes.
+    uint64_t freeSpace();
+
+    /*!
+     * Size of a circular buffer that can hold _latency seconds of a stream
+     * producing _bytesPerSec bytes per second in chunks of at most
+     * _maxChunkSize bytes.
+     */
+    static uint64_t ringSize(double _bytesPerSec, int _maxChunkSize, double _latency);
+
+private:
+    int                         memFd;
+    uint64_t                    size;
+    uint64_t                    pageSize;
+    bool                        hugePages;
+    bool                        lockMemory;
+
+    std::map<uint64_t, uint64_t> freeSlices;   // offset -> size, never adjacent
+    QMutex                      mutex;
+};
+
+#endif /* BUFFERARENA_H_ */
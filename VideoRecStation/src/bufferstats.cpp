@@ -0,0 +1,140 @@
+/*
+ * bufferstats.cpp
+ *
+ * Author: Andrey Zhdanov
+ * Copyright (C) 2014 BioMag Laboratory, Helsinki University Central Hospital
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <time.h>
+#include <algorithm>
+
+#include "bufferstats.h"
+
+using namespace std;
+
+
+LatencyHistogram::LatencyHistogram()
+{
+    for (int i=0; i<N_BUCKETS; i++)
+    {
+        buckets[i] = 0;
+    }
+    total = 0;
+    sum = 0;
+    maxValue = 0;
+}
+
+
+void LatencyHistogram::record(uint64_t _value)
+{
+    uint64_t    prevMax = maxValue.load(memory_order_relaxed);
+
+    buckets[bucketIndex(_value)].fetch_add(1, memory_order_relaxed);
+    sum.fetch_add(_value, memory_order_relaxed);
+    total.fetch_add(1, memory_order_relaxed);
+
+    while (_value > prevMax && !maxValue.compare_exchange_weak(prevMax, _value, memory_order_relaxed));
+}
+
+
+uint64_t LatencyHistogram::count() const
+{
+    return(total.load(memory_order_relaxed));
+}
+
+
+uint64_t LatencyHistogram::max() const
+{
+    return(maxValue.load(memory_order_relaxed));
+}
+
+
+double LatencyHistogram::mean() const
+{
+    uint64_t    n = total.load(memory_order_relaxed);
+
+    return(n ? double(sum.load(memory_order_relaxed)) / n : 0);
+}
+
+
+uint64_t LatencyHistogram::percentile(double _percentile) const
+{
+    uint64_t    n = total.load(memory_order_relaxed);
+    uint64_t    target = uint64_t(_percentile / 100 * n + 0.5);
+    uint64_t    seen = 0;
+
+    if (!n)
+    {
+        return(0);
+    }
+    if (target < 1)
+    {
+        target = 1;
+    }
+
+    for (int i=0; i<N_BUCKETS; i++)
+    {
+        seen += buckets[i].load(memory_order_relaxed);
+        if (seen >= target)
+        {
+            return(i < N_BUCKETS - 1 ? min(bucketTop(i), max()) : max());
+        }
+    }
+
+    return(max());
+}
+
+
+uint64_t LatencyHistogram::now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(uint64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000);
+}
+
+
+int LatencyHistogram::bucketIndex(uint64_t _value)
+{
+    int shift;
+
+    if (_value < SUB_BUCKETS)
+    {
+        return(_value);
+    }
+    if (_value >> LATENCY_HISTOGRAM_MAX_BITS)
+    {
+        return(N_BUCKETS - 1);
+    }
+
+    // The top LATENCY_HISTOGRAM_PRECISION + 1 bits of the value select the bucket
+    shift = 63 - __builtin_clzll(_value) - LATENCY_HISTOGRAM_PRECISION;
+    return(shift * SUB_BUCKETS + (_value >> shift));
+}
+
+
+uint64_t LatencyHistogram::bucketTop(int _idx)
+{
+    int shift;
+
+    if (_idx < SUB_BUCKETS)
+    {
+        return(_idx);
+    }
+
+    shift = _idx / SUB_BUCKETS - 1;
+    return(((uint64_t(_idx - shift * SUB_BUCKETS) + 1) << shift) - 1);
+}
@@ -0,0 +1,91 @@
+/*
+ * bufferstats.h
+ *
+ * Author: Andrey Zhdanov
+ * Copyright (C) 2014 BioMag Laboratory, Helsinki University Central Hospital
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef BUFFERSTATS_H_
+#define BUFFERSTATS_H_
+
+#include <stdint.h>
+#include <atomic>
+
+#include "config.h"
+
+//! Occupancy statistics of a buffer.
+/*!
+ * Occupancy is in bytes for CycDataBuffer and in chunks for
+ * NonBlockingBuffer.
+ */
+typedef struct
+{
+    uint64_t    size;               // capacity of the buffer
+    uint64_t    occupancy;          // current occupancy
+    uint64_t    peakOccupancy;      // highest occupancy so far
+    uint64_t    chunksIn;           // number of chunks inserted
+    uint64_t    chunksOut;          // number of chunks taken by the (primary) consumer
+} BufferStats;
+
+
+//! Histogram of latencies with a bounded relative error.
+/*!
+ * The values (microseconds) are counted in buckets whose width grows with
+ * the value, as in HDR histograms: every power of two is split into
+ * 2^LATENCY_HISTOGRAM_PRECISION buckets, so the relative error of the
+ * reported values is below 2^-LATENCY_HISTOGRAM_PRECISION. Values above
+ * 2^LATENCY_HISTOGRAM_MAX_BITS are counted in the last bucket.
+ *
+ * The histogram is lock-free: values can be recorded and the statistics
+ * read from any thread at any time. The statistics read while values are
+ * being recorded may be off by the values being recorded.
+ */
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void record(uint64_t _value);
+
+    uint64_t count() const;
+    uint64_t max() const;
+    double mean() const;
+
+    //! Smallest value that _percentile percent of the recorded values do not exceed (within the precision).
+    uint64_t percentile(double _percentile) const;
+
+    //! Current monotonic time in microseconds.
+    static uint64_t now();
+
+private:
+    enum
+    {
+        SUB_BUCKETS = 1 << LATENCY_HISTOGRAM_PRECISION,
+        N_BUCKETS = (LATENCY_HISTOGRAM_MAX_BITS - LATENCY_HISTOGRAM_PRECISION + 1) * SUB_BUCKETS
+    };
+
+    static int bucketIndex(uint64_t _value);
+
+    //! Highest value counted in the bucket _idx.
+    static uint64_t bucketTop(int _idx);
+
+    std::atomic<uint64_t>   buckets[N_BUCKETS];
+    std::atomic<uint64_t>   total;
+    std::atomic<uint64_t>   sum;
+    std::atomic<uint64_t>   maxValue;
+};
+
+#endif /* BUFFERSTATS_H_ */
@@ -20,8 +20,12 @@
 #include <iostream>
 #include <sched.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <QCoreApplication>
 #include <stdlib.h>
+#include <string.h>
 #include <QTime>
 
 #include "camerathread.h"
@@ -30,22 +34,39 @@
 using namespace std;
 
 
-CameraThread::CameraThread(dc1394camera_t* _camera, CycDataBuffer* _cycBuf, bool _color)
+CameraThread::CameraThread(dc1394camera_t* _camera, CycDataBuffer* _cycBuf, PixelFormat _format, unsigned int _dmaBuffers, bool _zeroCopy)
 {
-    dc1394error_t err;
+    dc1394error_t       err;
+    dc1394video_mode_t  videoMode;
 
     cycBuf = _cycBuf;
-    color = _color;
+    format = _format;
     shouldStop = false;
 
     camera = _camera;
 
+    releasedHead = 0;
+    releasedTail = 0;
+    releaseSeq = 0;
+    cameraWaiting = false;
+    framesOut = 0;
+
+    dmaBuffers = _dmaBuffers;
+    if (dmaBuffers < 1 || dmaBuffers > MAX_DMA_BUFFERS)
+    {
+        cerr << "Invalid number of DMA buffers (" << dmaBuffers << "), using " << N_CAMERA_BUFFERS << endl;
+        dmaBuffers = N_CAMERA_BUFFERS;
+    }
+
     // Dummy mode
     if (camera == NULL)
     {
+        zeroCopy = false;
         return;
     }
 
+    zeroCopy = _zeroCopy;
+
     /*-----------------------------------------------------------------------
      *  setup capture
      *-----------------------------------------------------------------------*/
@@ -63,7 +84,23 @@ CameraThread::CameraThread(dc1394camera_t* _camera, CycDataBuffer* _cycBuf, bool
         abort();
     }
 
-    err = dc1394_video_set_mode(camera, (color ? DC1394_VIDEO_MODE_640x480_RGB8 : DC1394_VIDEO_MODE_640x480_MONO8));
+    switch (format)
+    {
+    case PIXEL_FORMAT_RGB8:
+        videoMode = DC1394_VIDEO_MODE_640x480_RGB8;
+        break;
+    case PIXEL_FORMAT_YUV422:
+        videoMode = DC1394_VIDEO_MODE_640x480_YUV422;
+        break;
+    case PIXEL_FORMAT_YUV411:
+        videoMode = DC1394_VIDEO_MODE_640x480_YUV411;
+        break;
+    default:
+        videoMode = DC1394_VIDEO_MODE_640x480_MONO8;
+        break;
+    }
+
+    err = dc1394_video_set_mode(camera, videoMode);
     if (err != DC1394_SUCCESS)
     {
         cerr << "Could not set video mode" << endl;
@@ -77,7 +114,7 @@ CameraThread::CameraThread(dc1394camera_t* _camera, CycDataBuffer* _cycBuf, bool
         abort();
     }
 
-    err = dc1394_capture_setup(camera, N_CAMERA_BUFFERS, DC1394_CAPTURE_FLAGS_DEFAULT);
+    err = dc1394_capture_setup(camera, dmaBuffers, DC1394_CAPTURE_FLAGS_DEFAULT);
     if (err != DC1394_SUCCESS)
     {
         cerr << "Could not setup camera-" << endl \
@@ -105,6 +142,79 @@ CameraThread::~CameraThread()
 }
 
 
+bool CameraThread::isZeroCopy()
+{
+    return(zeroCopy);
+}
+
+
+dc1394video_frame_t* CameraThread::chunkToFrame(unsigned char* _chunk)
+{
+    dc1394video_frame_t* frame;
+
+    memcpy(&frame, _chunk, sizeof(dc1394video_frame_t*));
+    return(frame);
+}
+
+
+void CameraThread::releaseFrame(dc1394video_frame_t* _frame)
+{
+    unsigned int head = releasedHead.load(memory_order_relaxed);
+
+    // Never more than dmaBuffers frames are out, so the queue cannot overflow
+    releasedFrames[head % MAX_DMA_BUFFERS] = _frame;
+
+    // The sequentially consistent store pairs with the camera thread's store
+    // to cameraWaiting in waitForRelease(): either the camera thread sees the
+    // frame or we see that it is (about to be) asleep.
+    releasedHead.store(head + 1, memory_order_seq_cst);
+    if (cameraWaiting.load(memory_order_seq_cst))
+    {
+        releaseSeq.fetch_add(1, memory_order_release);
+        syscall(SYS_futex, (int*)&releaseSeq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+
+void CameraThread::requeueReleasedFrames()
+{
+    dc1394error_t   err;
+    unsigned int    tail = releasedTail.load(memory_order_relaxed);
+    unsigned int    head = releasedHead.load(memory_order_acquire);
+
+    for (; tail != head; tail++)
+    {
+        err = dc1394_capture_enqueue(camera, releasedFrames[tail % MAX_DMA_BUFFERS]);
+        if (err != DC1394_SUCCESS)
+        {
+            cerr << "Error re-enqueuing a frame" << endl;
+            abort();
+        }
+        framesOut--;
+    }
+
+    releasedTail.store(tail, memory_order_release);
+}
+
+
+void CameraThread::waitForRelease()
+{
+    struct timespec timeout;
+    int             seq = releaseSeq.load(memory_order_acquire);
+
+    timeout.tv_sec = FRAME_RELEASE_WAIT / 1000;
+    timeout.tv_nsec = (FRAME_RELEASE_WAIT % 1000) * 1000000;
+
+    cameraWaiting.store(true, memory_order_seq_cst);
+    if (releasedHead.load(memory_order_seq_cst) == releasedTail.load(memory_order_relaxed))
+    {
+        // Returns immediately if releaseFrame() has bumped releaseSeq in the meantime
+        syscall(SYS_futex, (int*)&releaseSeq, FUTEX_WAIT_PRIVATE, seq, &timeout, NULL, 0);
+    }
+    cameraWaiting.store(false, memory_order_relaxed);
+}
+
+
 void CameraThread::stoppableRun()
 {
     dc1394error_t           err;
@@ -116,8 +226,10 @@ void CameraThread::stoppableRun()
     unsigned char*          fakeImage;
     QTime                   time;
 
-    chunkSize = VIDEO_HEIGHT * VIDEO_WIDTH * (color ? 3 : 1);
-    chunkAttrib.chunkSize = chunkSize;
+    chunkSize = VIDEO_HEIGHT * rawRowSize(format, VIDEO_WIDTH);
+    // In zero-copy mode only the pointer to the frame goes to the buffer
+    chunkAttrib.chunkSize = (zeroCopy ? sizeof(dc1394video_frame_t*) : chunkSize);
+    chunkAttrib.blockId = 0;
 
     // Set priority
     sch_param.sched_priority = CAM_THREAD_PRIORITY;
@@ -138,6 +250,7 @@ void CameraThread::stoppableRun()
             msleep(33);
             clock_gettime(CLOCK_REALTIME, &timestamp);
             chunkAttrib.timestamp = timestamp.tv_nsec / 1000000 + timestamp.tv_sec * 1000;
+            chunkAttrib.blockId++;
             for(unsigned int i=0; i < chunkSize; i++)
                 fakeImage[i] = (unsigned char) qrand();
             cycBuf->insertChunk(fakeImage, chunkAttrib);
@@ -159,6 +272,19 @@ void CameraThread::stoppableRun()
     // Start the acquisition loop
     while (!shouldStop)
     {
+        if (zeroCopy)
+        {
+            requeueReleasedFrames();
+
+            // All the DMA buffers are held by the consumer; the camera cannot
+            // deliver anything until at least one of them is released.
+            if (framesOut == dmaBuffers)
+            {
+                waitForRelease();
+                continue;
+            }
+        }
+
         err = dc1394_capture_dequeue(camera, DC1394_CAPTURE_POLICY_WAIT, &frame);
         clock_gettime(CLOCK_REALTIME, &timestamp);
 
@@ -169,7 +295,23 @@ void CameraThread::stoppableRun()
         }
 
         chunkAttrib.timestamp = timestamp.tv_nsec / 1000000 + timestamp.tv_sec * 1000;
-        cycBuf->insertChunk(frame->image, chunkAttrib);
+        chunkAttrib.blockId++;     // frames lost on the way to the file leave gaps
+
+        if (zeroCopy)
+        {
+            // Pass the frame by reference, it is re-enqueued once released
+            if (cycBuf->insertChunk((unsigned char*)(&frame), chunkAttrib))
+            {
+                framesOut++;
+                continue;
+            }
+            // The chunk has been dropped because of an overflow, the
+            // consumer will never release the frame
+        }
+        else
+        {
+            cycBuf->insertChunk(frame->image, chunkAttrib);
+        }
 
         err = dc1394_capture_enqueue(camera, frame);
         if (err != DC1394_SUCCESS)
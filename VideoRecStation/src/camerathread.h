@@ -20,25 +20,69 @@
 #ifndef CAMERATHREAD_H_
 #define CAMERATHREAD_H_
 
+#include <atomic>
 #include <dc1394/dc1394.h>
 
+#include "config.h"
 #include "stoppablethread.h"
 #include "cycdatabuffer.h"
+#include "pixelformat.h"
 
 //! This thread acquires and timestamps frames for a single libdc1394 video camera.
+/*!
+ * In the default mode every frame is copied from the libdc1394 DMA ring to
+ * the circular buffer and the DMA buffer is re-enqueued immediately.
+ *
+ * In zero-copy mode the thread inserts into the circular buffer only a
+ * pointer to the dc1394video_frame_t. The consumer should read the image
+ * directly from the DMA buffer and hand the frame back with releaseFrame()
+ * once it is done with it; the frame is re-enqueued by the camera thread.
+ * If the consumer holds all the DMA buffers, the camera thread sleeps on a
+ * futex until releaseFrame() wakes it up. Zero-copy mode is not available
+ * in dummy mode.
+ */
 class CameraThread : public StoppableThread
 {
 public:
-    CameraThread(dc1394camera_t* _camera, CycDataBuffer* _cycBuf, bool _color);
+    CameraThread(dc1394camera_t* _camera, CycDataBuffer* _cycBuf, PixelFormat _format, unsigned int _dmaBuffers=N_CAMERA_BUFFERS, bool _zeroCopy=false);
     virtual ~CameraThread();
 
+    bool isZeroCopy();
+
+    //! Return the frame referenced by a chunk inserted in zero-copy mode.
+    static dc1394video_frame_t* chunkToFrame(unsigned char* _chunk);
+
+    //! Give a frame obtained through zero-copy chunk back to the camera.
+    /*!
+     * Should be called exactly once for every zero-copy chunk, by a single
+     * consumer thread.
+     */
+    void releaseFrame(dc1394video_frame_t* _frame);
+
 protected:
     virtual void stoppableRun();
 
 private:
+    //! Re-enqueue all the frames released by the consumer.
+    void requeueReleasedFrames();
+
+    //! Sleep until the consumer releases a frame (or for at most FRAME_RELEASE_WAIT ms).
+    void waitForRelease();
+
     dc1394camera_t* camera;
     CycDataBuffer*  cycBuf;
-    bool            color;
+    PixelFormat     format;
+    unsigned int    dmaBuffers;
+    bool            zeroCopy;
+
+    // Frames released by the consumer but not re-enqueued yet. Single
+    // producer (consumer of the frames), single consumer (camera thread).
+    dc1394video_frame_t*        releasedFrames[MAX_DMA_BUFFERS];
+    std::atomic<unsigned int>   releasedHead;
+    std::atomic<unsigned int>   releasedTail;
+    std::atomic<int>            releaseSeq;     // futex word the camera thread sleeps on
+    std::atomic<bool>           cameraWaiting;
+    unsigned int                framesOut;      // dequeued and not re-enqueued yet
 };
 
 #endif /* CAMERATHREAD_H_ */
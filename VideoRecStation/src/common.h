@@ -30,11 +30,28 @@
 #define AUDIO_DATA_TYPE     int16_t                 // should match AUDIO_FORMAT
 #define MAX_AUDIO_VAL       INT16_MAX               // should match AUDIO_FORMAT
 
-#define AUDIO_FILE_VERSION  1
-#define VIDEO_FILE_VERSION  1
+#define AUDIO_FILE_VERSION  2
+#define VIDEO_FILE_VERSION  2
+#define VIDEO_FILE_VERSION_CODEC    5   // version 2 + codec tag, used for non-JPEG video
+#define INDEX_FILE_VERSION  2
+
+// Codecs of the video chunks (codec tag of the video file)
+#define VIDEO_CODEC_JPEG    0
+#define VIDEO_CODEC_ZSTD    1
+#define VIDEO_CODEC_LZ4     2
+
+#define LOSSLESS_FILTER_UP  1           // row filter of the lossless codecs
 
 #define MAGIC_VIDEO_STR     "ELEKTA_VIDEO_FILE"
 #define MAGIC_AUDIO_STR     "ELEKTA_AUDIO_FILE"
+#define MAGIC_INDEX_STR     "ELEKTA_INDEX_FILE"
+
+// Every chunk in the audio/video files starts with timestamp (uint64), block
+// ID (uint64) and size (uint32)
+#define CHUNK_HEADER_SIZE   (2 * sizeof(uint64_t) + sizeof(uint32_t))
+
+// Name of the index of a data file: the data file's name + INDEX_FILE_EXT
+#define INDEX_FILE_EXT      ".idx"
 
 #define COMMON_H_
 
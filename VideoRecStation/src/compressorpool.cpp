@@ -0,0 +1,320 @@
+/*
+ * compressorpool.cpp
+ *
+ * Author: Andrey Zhdanov
+ * Copyright (C) 2014 BioMag Laboratory, Helsinki University Central Hospital
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <time.h>
+#include <iostream>
+#include <QMutexLocker>
+
+#include "config.h"
+#include "compressorpool.h"
+
+using namespace std;
+
+
+CompressorPool::CompressorPool(int _nWorkers, const QString& _encoderBackend)
+{
+    stopping = false;
+    encoderBackend = _encoderBackend;
+
+    for (int i=0; i<MAX_CAMERAS; i++)
+    {
+        streams[i].active = false;
+        streams[i].generation = 0;
+        streams[i].tasksLeft = NULL;
+    }
+
+    nWorkers = _nWorkers;
+    for (int i=0; i<nWorkers; i++)
+    {
+        workers.push_back(new Worker(this, i));
+    }
+
+    for (int i=0; i<nWorkers; i++)
+    {
+        workers[i]->start();
+    }
+}
+
+
+CompressorPool::~CompressorPool()
+{
+    // Wake up all the workers so that they notice they should stop
+    stopping = true;
+    tasksQueued.release(nWorkers);
+
+    for (int i=0; i<nWorkers; i++)
+    {
+        workers[i]->stop();
+        delete workers[i];
+    }
+}
+
+
+int CompressorPool::addStream(CycDataBuffer* _inpBuf, CycDataBuffer* _outBuf, PixelFormat _format, int _jpgQuality,
+                              CameraThread* _frameSource, RateController* _rateController)
+{
+    QMutexLocker    locker(&streamsMutex);
+    FrameEncoder*   probe;
+    int             id;
+
+    for (id=0; id<MAX_CAMERAS; id++)
+    {
+        if (!streams[id].active)
+        {
+            break;
+        }
+    }
+
+    if (id == MAX_CAMERAS)
+    {
+        cerr << "Too many streams in the compressor pool!" << endl;
+        abort();
+    }
+
+    Stream& stream = streams[id];
+
+    // Find out how much space the compressed frames might need
+    probe = FrameEncoder::create(encoderBackend, VIDEO_WIDTH, VIDEO_HEIGHT, _format, _jpgQuality);
+    stream.maxOutputSize = probe->maxOutputSize();
+    delete probe;
+
+    stream.generation++;
+    stream.inpBuf = _inpBuf;
+    stream.outBuf = _outBuf;
+
+    // The workers commit the frames reserved by the submitting thread
+    stream.outBuf->setConcurrentCommit(true);
+    stream.frameSource = _frameSource;
+    stream.format = _format;
+    stream.jpgQuality = _jpgQuality;
+    stream.rateController = _rateController;
+    stream.nextSubmitSeq = 0;
+    stream.nextCommitSeq = 0;
+
+    for (int i=0; i<POOL_TASKS_PER_STREAM; i++)
+    {
+        Task* task = new Task;
+        stream.allTasks.push_back(task);
+        stream.freeTasks.push_back(task);
+    }
+    stream.tasksLeft = new QSemaphore(POOL_TASKS_PER_STREAM);
+
+    stream.active = true;
+
+    return(id);
+}
+
+
+void CompressorPool::removeStream(int _streamId)
+{
+    Stream& stream = streams[_streamId];
+
+    // Wait for all the frames in flight
+    stream.tasksLeft->acquire(POOL_TASKS_PER_STREAM);
+
+    QMutexLocker locker(&streamsMutex);
+
+    stream.active = false;
+    for (unsigned int i=0; i<stream.allTasks.size(); i++)
+    {
+        delete stream.allTasks[i];
+    }
+    stream.allTasks.clear();
+    stream.freeTasks.clear();
+    stream.done.clear();
+    delete stream.tasksLeft;
+    stream.tasksLeft = NULL;
+}
+
+
+void CompressorPool::submit(int _streamId, unsigned char* _data, ChunkAttrib _attrib)
+{
+    Stream& stream = streams[_streamId];
+    Task*   task;
+
+    stream.tasksLeft->acquire();
+
+    stream.reorderMutex.lock();
+    task = stream.freeTasks.back();
+    stream.freeTasks.pop_back();
+    stream.reorderMutex.unlock();
+
+    // The frames are reserved (and later committed) in submission order
+    task->seq = stream.nextSubmitSeq++;
+    task->data = _data;
+    task->attrib = _attrib;
+    task->jpgBuf = stream.outBuf->reserveChunk(stream.maxOutputSize);
+
+    stream.queueMutex.lock();
+    stream.queue.push_back(task);
+    stream.queueMutex.unlock();
+
+    tasksQueued.release();
+}
+
+
+CompressorPool::Task* CompressorPool::takeTask(int _workerIdx, int* _streamId)
+{
+    Task*           task = NULL;
+    int             victim = -1;
+    unsigned int    victimLen = 0;
+
+    // Serve the home streams first
+    for (int i=_workerIdx; i<MAX_CAMERAS; i+=nWorkers)
+    {
+        QMutexLocker locker(&(streams[i].queueMutex));
+        if (!streams[i].queue.empty())
+        {
+            task = streams[i].queue.front();
+            streams[i].queue.pop_front();
+            *_streamId = i;
+            return(task);
+        }
+    }
+
+    // Steal the oldest frame of the longest queue
+    for (int i=0; i<MAX_CAMERAS; i++)
+    {
+        QMutexLocker locker(&(streams[i].queueMutex));
+        if (streams[i].queue.size() > victimLen)
+        {
+            victim = i;
+            victimLen = streams[i].queue.size();
+        }
+    }
+
+    if (victim >= 0)
+    {
+        QMutexLocker locker(&(streams[victim].queueMutex));
+        if (!streams[victim].queue.empty())
+        {
+            task = streams[victim].queue.front();
+            streams[victim].queue.pop_front();
+            *_streamId = victim;
+        }
+    }
+
+    return(task);
+}
+
+
+void CompressorPool::completeTask(int _streamId, Task* _task)
+{
+    Stream&         stream = streams[_streamId];
+    Task*           task;
+    QMutexLocker    locker(&(stream.reorderMutex));
+
+    stream.done[_task->seq] = _task;
+
+    // Commit all the frames that are now in order
+    while (!stream.done.empty() && stream.done.begin()->first == stream.nextCommitSeq)
+    {
+        task = stream.done.begin()->second;
+        stream.done.erase(stream.done.begin());
+
+        stream.outBuf->commitChunk(task->jpgSize, task->attrib);
+
+        if (stream.frameSource)
+        {
+            stream.frameSource->releaseFrame(CameraThread::chunkToFrame(task->data));
+        }
+        stream.inpBuf->releaseChunk();
+
+        if (stream.rateController)
+        {
+            stream.rateController->frameDone(task->attrib.timestamp, task->encodeTime, task->quality);
+        }
+
+        stream.nextCommitSeq++;
+        stream.freeTasks.push_back(task);
+        stream.tasksLeft->release();
+    }
+}
+
+
+CompressorPool::Worker::Worker(CompressorPool* _pool, int _idx)
+{
+    pool = _pool;
+    idx = _idx;
+
+    for (int i=0; i<MAX_CAMERAS; i++)
+    {
+        encoders[i] = NULL;
+        encoderGens[i] = -1;
+        encoderQualities[i] = -1;
+    }
+}
+
+
+CompressorPool::Worker::~Worker()
+{
+    for (int i=0; i<MAX_CAMERAS; i++)
+    {
+        delete encoders[i];
+    }
+}
+
+
+void CompressorPool::Worker::stoppableRun()
+{
+    Task*           task;
+    int             streamId;
+    unsigned char*  image;
+    struct timespec encodeStart;
+    struct timespec encodeEnd;
+
+    while (!pool->stopping)
+    {
+        pool->tasksQueued.acquire();
+
+        task = pool->takeTask(idx, &streamId);
+        if (!task)
+        {
+            continue;
+        }
+
+        Stream& stream = pool->streams[streamId];
+
+        // The encoders are created lazily and recreated whenever the stream
+        // slot is reused by a new camera
+        if (encoderGens[streamId] != stream.generation)
+        {
+            delete encoders[streamId];
+            encoders[streamId] = FrameEncoder::create(pool->encoderBackend, VIDEO_WIDTH, VIDEO_HEIGHT, stream.format, stream.jpgQuality);
+            encoderGens[streamId] = stream.generation;
+            encoderQualities[streamId] = stream.jpgQuality;
+        }
+
+        if (stream.rateController && stream.rateController->getQuality() != encoderQualities[streamId])
+        {
+            encoderQualities[streamId] = stream.rateController->getQuality();
+            encoders[streamId]->setQuality(encoderQualities[streamId]);
+        }
+        task->quality = encoderQualities[streamId];
+
+        image = (stream.frameSource ? CameraThread::chunkToFrame(task->data)->image : task->data);
+        clock_gettime(CLOCK_MONOTONIC, &encodeStart);
+        task->jpgSize = encoders[streamId]->encode(image, task->jpgBuf);
+        clock_gettime(CLOCK_MONOTONIC, &encodeEnd);
+        task->encodeTime = (encodeEnd.tv_sec - encodeStart.tv_sec) * 1000000 + (encodeEnd.tv_nsec - encodeStart.tv_nsec) / 1000;
+
+        pool->completeTask(streamId, task);
+    }
+}
@@ -0,0 +1,156 @@
+/*
+ * compressorpool.h
+ *
+ * Author: Andrey Zhdanov
+ * Copyright (C) 2014 BioMag Laboratory, Helsinki University Central Hospital
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMPRESSORPOOL_H_
+#define COMPRESSORPOOL_H_
+
+#include <deque>
+#include <map>
+#include <vector>
+#include <QMutex>
+#include <QSemaphore>
+#include <QString>
+
+#include "common.h"
+#include "stoppablethread.h"
+#include "cycdatabuffer.h"
+#include "camerathread.h"
+#include "frameencoder.h"
+#include "ratecontroller.h"
+
+//! Process-wide pool of video compressor threads shared by all the cameras.
+/*!
+ * Every camera registers a stream with addStream(). Raw frames are handed to
+ * the pool with submit() (typically by the stream's VideoCompressorThread
+ * running in dispatcher mode) and land in a per-stream queue. Each worker
+ * thread serves the queues of its "home" streams first and steals the oldest
+ * frame from the longest queue of the other streams when its own queues are
+ * empty, so that a busy camera can use the cores left idle by the others.
+ *
+ * Frames of a stream can be compressed out of order by different workers.
+ * Space for every frame is reserved in the stream's output buffer when the
+ * frame is submitted, and the worker compresses the frame directly there. A
+ * per-stream reorder stage commits the compressed frames strictly in
+ * submission order, and releases the input chunks (and, in zero-copy mode,
+ * the DMA frames) in the same order.
+ *
+ * The input chunks are acquired by the dispatcher with
+ * CycDataBuffer::acquireChunk() and released by the pool.
+ *
+ * All the streams should be removed before the pool is destroyed.
+ */
+class CompressorPool
+{
+public:
+    CompressorPool(int _nWorkers, const QString& _encoderBackend);
+    virtual ~CompressorPool();
+
+    //! Register a stream and return its id.
+    /*!
+     * If _rateController is not NULL, it sets the quality of the stream's
+     * frames instead of _jpgQuality.
+     */
+    int addStream(CycDataBuffer* _inpBuf, CycDataBuffer* _outBuf, PixelFormat _format, int _jpgQuality,
+                  CameraThread* _frameSource=NULL, RateController* _rateController=NULL);
+
+    //! Wait until all the frames of the stream are compressed and unregister it.
+    /*!
+     * Should only be called after the stream's dispatcher has stopped.
+     */
+    void removeStream(int _streamId);
+
+    //! Queue a raw frame acquired from the stream's input buffer for compression.
+    /*!
+     * Blocks if the stream already has POOL_TASKS_PER_STREAM frames in flight.
+     * Should only be called by a single (dispatcher) thread per stream.
+     */
+    void submit(int _streamId, unsigned char* _data, ChunkAttrib _attrib);
+
+private:
+    struct Task
+    {
+        uint64_t        seq;
+        unsigned char*  data;
+        ChunkAttrib     attrib;
+        unsigned char*  jpgBuf;         // reserved in the output buffer
+        int             jpgSize;
+        int             quality;
+        uint64_t        encodeTime;     // in microseconds
+    };
+
+    struct Stream
+    {
+        bool                    active;
+        int                     generation;     // incremented every time the slot is reused
+        CycDataBuffer*          inpBuf;
+        CycDataBuffer*          outBuf;
+        CameraThread*           frameSource;
+        PixelFormat             format;
+        int                     jpgQuality;
+        RateController*         rateController;
+        int                     maxOutputSize;
+
+        // Frames waiting for a worker
+        QMutex                  queueMutex;
+        std::deque<Task*>       queue;
+
+        // Reorder stage, protected by reorderMutex
+        QMutex                  reorderMutex;
+        uint64_t                nextCommitSeq;
+        std::map<uint64_t, Task*> done;
+        std::vector<Task*>      freeTasks;
+        std::vector<Task*>      allTasks;
+
+        QSemaphore*             tasksLeft;      // limits the number of frames in flight
+        uint64_t                nextSubmitSeq;  // dispatcher-only
+    };
+
+    class Worker : public StoppableThread
+    {
+    public:
+        Worker(CompressorPool* _pool, int _idx);
+        virtual ~Worker();
+
+    protected:
+        virtual void stoppableRun();
+
+    private:
+        CompressorPool* pool;
+        int             idx;
+        FrameEncoder*   encoders[MAX_CAMERAS];
+        int             encoderGens[MAX_CAMERAS];
+        int             encoderQualities[MAX_CAMERAS];
+    };
+
+    //! Take the next task for the given worker; return NULL if there is none.
+    Task* takeTask(int _workerIdx, int* _streamId);
+
+    //! Hand a compressed frame to the reorder stage of its stream.
+    void completeTask(int _streamId, Task* _task);
+
+    Stream              streams[MAX_CAMERAS];
+    QMutex              streamsMutex;       // protects adding/removing streams
+    std::vector<Worker*> workers;
+    int                 nWorkers;
+    QSemaphore          tasksQueued;        // total number of queued tasks
+    volatile bool       stopping;
+    QString             encoderBackend;
+};
+
+#endif /* COMPRESSORPOOL_H_ */
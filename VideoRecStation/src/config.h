@@ -22,7 +22,11 @@
 
 // Camera configuration
 #define VIDEO_DEV_PATH      "/dev/video0"
-#define N_CAMERA_BUFFERS    1
+#define N_CAMERA_BUFFERS    1           // default DMA ring depth when frames are copied
+#define N_ZERO_COPY_BUFFERS 8           // default DMA ring depth for zero-copy capture
+#define MAX_DMA_BUFFERS     64
+#define FRAME_RELEASE_WAIT  100         // ms the zero-copy camera thread waits for a frame at a time, to notice stop()
+#define VIDEO_FRAME_RATE    30          // frames per second, as set up by CameraThread
 
 #define SHUTTER_ADDR        0xf0081c
 #define SHUTTER_MIN_VAL     1
@@ -42,27 +46,75 @@
 #define VR_MAX_VAL          0x238
 #define UV_REG_SHIFT        0x1000
 
+// Maximal number of frames per camera being compressed by the shared
+// compressor pool at the same time
+#define POOL_TASKS_PER_STREAM   8
+
+// Rate control (see RateController)
+#define RATE_CONTROL_FRAMES     15      // number of frames between quality adjustments
+#define RATE_CONTROL_LOW_OCC    0.02    // output buffer occupancy below which quality can be raised
+#define RATE_CONTROL_HIGH_OCC   0.2     // output buffer occupancy above which quality is lowered
+#define RATE_CONTROL_CRIT_OCC   0.4     // output buffer occupancy above which quality is lowered fast
+#define RATE_CONTROL_LOW_LOAD   0.6     // compressor/writer load below which quality can be raised
+#define RATE_CONTROL_HIGH_LOAD  0.9     // compressor/writer load above which quality is lowered
+#define RATE_CONTROL_STEP_UP    1
+#define RATE_CONTROL_STEP_DOWN  5
+
+// Maximal number of chunks and bytes the file writers write with a single
+// system call
+#define WRITE_BATCH_CHUNKS      256
+#define WRITE_BATCH_BYTES       (4 * 1024 * 1024)
+
+// Size of the submission queue of the I/O engine shared by the file writers
+#define IO_ENGINE_QUEUE_DEPTH   64
+
+// Staging buffers of the files written with O_DIRECT
+#define DIRECT_IO_ALIGNMENT     4096
+#define DIRECT_IO_BUFFER_SIZE   (4 * 1024 * 1024)   // multiple of DIRECT_IO_ALIGNMENT
+
 // Audio configuration
 #define N_CHANS             2           // stereo
 #define N_BUF_4_VOL_IND     10          // number of buffers used by volume indicator
 
 // Buffer parameters
-#define CIRC_BUF_MARG       0.2         // When less than this fraction of the buffer
-                                        // is left free, overflow error is generated.
-                                        // Used as a safety measure against race
-                                        // condition between consumer and producer
-                                        // threads when the circular buffer is close
-                                        // to full.
-
-#define MAX_CHUNK_SIZE      (CIRC_BUF_MARG/10)
-                                        // Maximum chunk size as a fraction of the
-                                        // circular buffer size. Should be at least
-                                        // several times smaller than CIRC_BUF_MARG
-                                        // for the buffer to work properly.
-
-// Buffer sizes
-#define CIRC_VIDEO_BUFF_SZ  100000000   // in bytes
-#define CIRC_AUDIO_BUFF_SZ  100000000   // in bytes
+#define OVERFLOW_EVICT_LEVEL 0.5        // With the catch_up overflow policy the
+                                        // oldest chunks are dropped whenever more
+                                        // than this fraction of the buffer is full.
+
+#define OVERFLOW_RESUME_LEVEL 0.25      // Buffer overflow is considered to be over
+                                        // once less than this fraction of the
+                                        // buffer is full.
+
+#define CHUNK_INDEX_LEN     256         // Number of most recent chunks secondary
+                                        // consumers can look up in a circular
+                                        // buffer.
+
+#define MAX_RESERVED_CHUNKS POOL_TASKS_PER_STREAM
+                                        // Number of chunks the producer can
+                                        // have reserved in a circular buffer
+                                        // at the same time.
+
+#define HUGE_PAGE_SIZE      (2 * 1024 * 1024)
+                                        // Size of the explicit huge pages
+                                        // (x86-64 default).
+
+#define MIN_BUFFER_CHUNKS   8           // Every circular buffer holds the data
+                                        // of its stream for the buffer latency
+                                        // set in the settings, but at least
+                                        // this many chunks.
+
+#define PRE_ROLL_MAX_LEVEL  0.75        // The file writers release the oldest
+                                        // pre-roll chunks early whenever more
+                                        // than this fraction of the buffer is
+                                        // full.
+
+#define LATENCY_HISTOGRAM_PRECISION 4   // Latency histograms of the buffers
+#define LATENCY_HISTOGRAM_MAX_BITS  36  // resolve 1/16 of every power of two
+                                        // up to 2^36 us, see LatencyHistogram.
+
+#define JPEG_RATE_FRACTION      0.25    // Expected size of the compressed
+#define LOSSLESS_RATE_FRACTION  0.75    // video relative to the raw one, used
+                                        // for sizing the buffers.
 
 // Thread priorities
 #define CAM_THREAD_PRIORITY 10
@@ -18,102 +18,944 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <linux/futex.h>
 #include <iostream>
+#include <algorithm>
+#include <QMutexLocker>
 
 #include "config.h"
 #include "cycdatabuffer.h"
+#include "bufferarena.h"
 
 using namespace std;
 
+// The futex system call operates on a plain int
+static_assert(sizeof(atomic<int>) == sizeof(int), "atomic<int> cannot be used as a futex word");
 
-CycDataBuffer::CycDataBuffer(int _bufSize)
+
+//! Round _size up to a multiple of _granularity.
+static uint64_t roundUp(uint64_t _size, uint64_t _granularity)
+{
+    return((_size + _granularity - 1) / _granularity * _granularity);
+}
+
+
+//! Map _size bytes at _offset of the file _fd twice, back to back. Return NULL on failure.
+static unsigned char* mapMirrored(int _fd, uint64_t _offset, uint64_t _size, uint64_t _alignment)
+{
+    unsigned char*  area;
+    unsigned char*  mem;
+
+    // Reserve enough address space for both views and align it
+    area = (unsigned char*)mmap(NULL, 2 * _size + _alignment, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (area == MAP_FAILED)
+    {
+        return(NULL);
+    }
+    mem = (unsigned char*)roundUp(uint64_t(area), _alignment);
+    if (mem > area)
+    {
+        munmap(area, mem - area);
+    }
+    munmap(mem + 2 * _size, area + _alignment - mem);
+
+    if (mmap(mem, _size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, _fd, _offset) == MAP_FAILED ||
+        mmap(mem + _size, _size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, _fd, _offset) == MAP_FAILED)
+    {
+        munmap(mem, 2 * _size);
+        return(NULL);
+    }
+
+    return(mem);
+}
+
+
+CycDataBuffer::CycDataBuffer(uint64_t _bufSize, bool _hugePages, bool _lockMemory)
+{
+    init();
+    allocate(_bufSize, _hugePages, _lockMemory);
+}
+
+
+CycDataBuffer::CycDataBuffer(BufferArena* _arena, uint64_t _bufSize)
+{
+    init();
+
+    arena = _arena;
+    bufSize = _bufSize;
+    if (arena->allocate(&bufSize, &arenaOffset))
+    {
+        dataBuf = mapMirrored(arena->fd(), arenaOffset, bufSize, arena->granularity());
+        if (dataBuf)
+        {
+            if (arena->isHugePages() && arena->granularity() < HUGE_PAGE_SIZE && madvise(dataBuf, 2 * bufSize, MADV_HUGEPAGE))
+            {
+                cerr << "Transparent huge pages are not supported" << endl;
+            }
+            prefault(arena->isLockMemory());
+            return;
+        }
+        arena->release(arenaOffset, bufSize);
+    }
+
+    // Fall back to memory of our own
+    clog << "Buffer arena exhausted, allocating " << _bufSize / (1024 * 1024) << " MB circular buffer separately" << endl;
+    arena = NULL;
+    allocate(_bufSize, _arena->isHugePages(), _arena->isLockMemory());
+}
+
+
+void CycDataBuffer::init()
 {
     insertPtr = 0;
+    for (int i=0; i<MAX_RESERVED_CHUNKS; i++)
+    {
+        reserved[i].scratchBuf = NULL;
+        reserved[i].scratchSize = 0;
+    }
+    firstReserved = 0;
+    nReserved = 0;
+    concurrentCommit = false;
     getPtr = 0;
+    bytesAcquired = 0;
+    releasePtr = 0;
+    bytesReleased = 0;
     isRec = false;
-    bufSize = _bufSize;
-    buffSemaphore = new QSemaphore();
+    epoch = NULL;
+    arena = NULL;
+    arenaOffset = 0;
+    dataBuf = NULL;
+    bufSize = 0;
+    locked = false;
+
+    bytesIn = 0;
+    bytesOut = 0;
+    wakeSeq = 0;
+    consumerWaiting = false;
+    spaceSeq = 0;
+    producerWaiting = false;
+
+    policy = OVERFLOW_ABORT;
+    name = "buffer";
+    timeoutMs = 0;
+    spillFile = NULL;
+    overflowing = false;
+    evicting = false;
+    overflows = 0;
+    droppedChunks = 0;
+    droppedBytes = 0;
+    spilledChunks = 0;
+    spilledBytes = 0;
+    blockedTime = 0;
+    firstDropTimestamp = 0;
+    lastDropTimestamp = 0;
+    peakOccupancy = 0;
+    chunksOut = 0;
+
+    chunkIndex = new IndexEntry[CHUNK_INDEX_LEN];
+    for (int i=0; i<CHUNK_INDEX_LEN; i++)
+    {
+        chunkIndex[i].seq = UINT64_MAX;
+        chunkIndex[i].pos = 0;
+    }
+    chunksIn = 0;
+    writeLimit = 0;
+}
+
+
+void CycDataBuffer::allocate(uint64_t _bufSize, bool _hugePages, bool _lockMemory)
+{
+    size_t  pageSize = sysconf(_SC_PAGESIZE);
+    int     fd;
+
+    // The buffer is an anonymous memory file mapped twice back to back, so
+    // that every chunk is contiguous in memory no matter where in the buffer
+    // it starts. The size of the buffer is rounded up to the page size.
+    if (_hugePages)
+    {
+        bufSize = roundUp(_bufSize, HUGE_PAGE_SIZE);
+        fd = memfd_create("cycdatabuffer", MFD_CLOEXEC | MFD_HUGETLB);
+        if (fd >= 0)
+        {
+            if (!ftruncate(fd, bufSize))
+            {
+                dataBuf = mapMirrored(fd, 0, bufSize, HUGE_PAGE_SIZE);
+            }
+            close(fd);
+        }
+
+        if (!dataBuf)
+        {
+            clog << "No huge pages available for circular buffer, using transparent huge pages" << endl;
+        }
+    }
 
-    // Allocate the buffer. Reserve some extra space necessary to handle
-    // chunks of varying size.
-    dataBuf = (unsigned char*)malloc(bufSize + 2 * (int(bufSize*MAX_CHUNK_SIZE) + sizeof(ChunkAttrib)));
     if (!dataBuf)
     {
-        cerr << "Cannot allocate memory for circular buffer" << endl;
-        abort();
+        bufSize = roundUp(_bufSize, pageSize);
+        fd = memfd_create("cycdatabuffer", MFD_CLOEXEC);
+        if (fd < 0 || ftruncate(fd, bufSize) || !(dataBuf = mapMirrored(fd, 0, bufSize, pageSize)))
+        {
+            cerr << "Cannot allocate memory for circular buffer" << endl;
+            abort();
+        }
+        close(fd);
+
+        if (_hugePages && madvise(dataBuf, 2 * bufSize, MADV_HUGEPAGE))
+        {
+            cerr << "Transparent huge pages are not supported" << endl;
+        }
+    }
+
+    prefault(_lockMemory);
+}
+
+
+void CycDataBuffer::prefault(bool _lockMemory)
+{
+    // Prefault the whole buffer so that no page faults happen on the
+    // producer's (real-time) thread. Locking also faults the pages in. Both
+    // views need their own page table entries, so both are touched.
+    if (_lockMemory)
+    {
+        if (mlock(dataBuf, 2 * bufSize))
+        {
+            cerr << "Could not lock circular buffer in memory (check RLIMIT_MEMLOCK), continuing without locking" << endl;
+        }
+        else
+        {
+            locked = true;
+        }
+    }
+
+    if (!locked)
+    {
+        memset(dataBuf, 0, 2 * bufSize);
     }
 }
 
 
 CycDataBuffer::~CycDataBuffer()
 {
-    free(dataBuf);
-    delete(buffSemaphore);
+    if (chunksIn)
+    {
+        clog << name << ": " << chunksIn << " chunk(s), peak occupancy " << 100 * peakOccupancy / bufSize
+             << "%, latency median " << latencyHist.percentile(50) << " us, 99% " << latencyHist.percentile(99)
+             << " us, max " << latencyHist.max() << " us" << endl;
+    }
+
+    if (overflows)
+    {
+        clog << name << ": " << overflows << " overflow(s), " << droppedChunks << " chunk(s) dropped, "
+             << spilledChunks << " chunk(s) spilled, producer blocked for " << blockedTime / 1000 << " ms" << endl;
+    }
+
+    if (spillFile)
+    {
+        fclose(spillFile);
+        if (!spilledChunks)
+        {
+            remove(spillFileName.c_str());
+        }
+    }
+    for (int i=0; i<MAX_RESERVED_CHUNKS; i++)
+    {
+        free(reserved[i].scratchBuf);
+    }
+
+    if (locked)
+    {
+        munlock(dataBuf, 2 * bufSize);
+    }
+    munmap(dataBuf, 2 * bufSize);
+    if (arena)
+    {
+        arena->release(arenaOffset, bufSize);
+    }
+    delete[] chunkIndex;
+}
+
+
+void CycDataBuffer::setOverflowPolicy(OverflowPolicy _policy, const char* _name, int _timeoutMs, const char* _spillPath)
+{
+    char        timeBuf[100];
+    time_t      timeNow;
+
+    policy = _policy;
+    name = _name;
+    timeoutMs = _timeoutMs;
+
+    if (policy == OVERFLOW_SPILL && !spillFile)
+    {
+        if (!_spillPath || !strlen(_spillPath))
+        {
+            cerr << name << ": no folder for the overflow file given, the chunks will be dropped on overflow" << endl;
+            policy = OVERFLOW_DROP_NEWEST;
+            return;
+        }
+
+        timeNow = time(NULL);
+        strftime(timeBuf, sizeof(timeBuf), "%Y-%m-%d--%H-%M-%S", localtime(&timeNow));
+        spillFileName = string(_spillPath) + "/" + timeBuf + "_" + name + ".overflow";
+        spillFile = fopen(spillFileName.c_str(), "wb");
+        if (!spillFile)
+        {
+            cerr << "Error opening the file " << spillFileName << ", the chunks will be dropped on overflow" << endl;
+            policy = OVERFLOW_DROP_NEWEST;
+        }
+    }
 }
 
 
-void CycDataBuffer::insertChunk(unsigned char* _data, ChunkAttrib _attrib)
+OverflowStats CycDataBuffer::overflowStats()
 {
-    // Check for buffer overflow. CIRC_BUF_MARG is the safety margin against
-    // race condition between consumer and producer threads when the buffer
-    // is close to full.
-    if (buffSemaphore->available() >=  bufSize * (1-CIRC_BUF_MARG))
+    OverflowStats   stats;
+
+    stats.overflows = overflows;
+    stats.droppedChunks = droppedChunks;
+    stats.droppedBytes = droppedBytes;
+    stats.spilledChunks = spilledChunks;
+    stats.spilledBytes = spilledBytes;
+    stats.blockedTime = blockedTime;
+    stats.firstTimestamp = firstDropTimestamp;
+    stats.lastTimestamp = lastDropTimestamp;
+
+    return(stats);
+}
+
+
+bool CycDataBuffer::insertChunk(unsigned char* _data, ChunkAttrib _attrib)
+{
+    memcpy(reserveChunk(_attrib.chunkSize), _data, _attrib.chunkSize);
+    return(commitChunk(_attrib.chunkSize, _attrib));
+}
+
+
+unsigned char* CycDataBuffer::reserveChunk(int _maxSize)
+{
+    QMutexLocker    locker(concurrentCommit ? &reserveMutex : NULL);
+    Reservation*    res;
+    uint64_t        pos;
+    unsigned char*  ptr;
+    bool            overflowStarted = false;
+    bool            overflowEnded = false;
+
+    if (nReserved == MAX_RESERVED_CHUNKS)
     {
-        cerr << "Circular buffer overflow!" << endl;
+        cerr << "Too many chunks reserved!" << endl;
         abort();
     }
 
-    // Make sure that the safety margin is at least several (four) times the
-    // chunk size. This is necessary to prevent the race condition between
-    // consumer and producer threads when the buffer is close to full.
-    if(_attrib.chunkSize+sizeof(ChunkAttrib) > bufSize*MAX_CHUNK_SIZE)
+    if(_maxSize+sizeof(ChunkHeader) > bufSize)
     {
         cerr << "The chunk size is too large!" << endl;
         abort();
     }
 
-    // insert the data into the circular buffer
-    _attrib.isRec = isRec;
+    // The chunks to be dropped or spilled are written to the scratch area
+    // instead of the buffer. Grow it to the largest chunk size seen; this
+    // normally happens with the first chunk, long before any overflow.
+    res = &reserved[(firstReserved + nReserved) % MAX_RESERVED_CHUNKS];
+    if (policy != OVERFLOW_ABORT && _maxSize > res->scratchSize)
+    {
+        free(res->scratchBuf);
+        res->scratchBuf = (unsigned char*)malloc(_maxSize);
+        if (!res->scratchBuf)
+        {
+            cerr << "Cannot allocate memory!" << endl;
+            abort();
+        }
+        memset(res->scratchBuf, 0, _maxSize);
+        res->scratchSize = _maxSize;
+    }
+
+    res->maxSize = _maxSize;
+    res->inScratch = false;
+
+    pos = placeChunk(_maxSize);
+    if (isFull(pos + sizeof(ChunkHeader) + _maxSize))
+    {
+        if (!overflowing)
+        {
+            overflowing = true;
+            overflows++;
+            overflowStarted = true;
+        }
+
+        switch (policy)
+        {
+        case OVERFLOW_ABORT:
+            cerr << "Circular buffer overflow!" << endl;
+            abort();
+
+        case OVERFLOW_BLOCK:
+            // Let the chunks reserved earlier be committed meanwhile,
+            // otherwise the consumer might never release any space
+            locker.unlock();
+            res->inScratch = !waitForSpace(pos + sizeof(ChunkHeader) + _maxSize);
+            locker.relock();
 
-    memcpy(dataBuf + insertPtr, (unsigned char*)(&_attrib), sizeof(ChunkAttrib));
-    insertPtr += sizeof(ChunkAttrib);
-    buffSemaphore->release(sizeof(ChunkAttrib));
+            // Committing can only have moved the chunk's place down
+            pos = placeChunk(_maxSize);
+            break;
 
-    memcpy(dataBuf + insertPtr, _data, _attrib.chunkSize);
-    buffSemaphore->release(_attrib.chunkSize);
+        default:
+            res->inScratch = true;
+            break;
+        }
+    }
+    else if (overflowing && bytesIn.load(memory_order_relaxed) - bytesOut.load(memory_order_acquire) < bufSize * OVERFLOW_RESUME_LEVEL)
+    {
+        overflowing = false;
+        overflowEnded = true;
+    }
 
-    emit chunkReady(dataBuf + insertPtr);
+    if (res->inScratch)
+    {
+        ptr = res->scratchBuf;
+    }
+    else
+    {
+        res->pos = pos;
+
+        // Announce the area about to be written to the secondary consumers.
+        // The release fence keeps the writes to the chunk from being
+        // reordered before the announcement. The limit never moves back, as
+        // some of the area announced earlier may have been written already.
+        writeLimit.store(max(writeLimit.load(memory_order_relaxed), pos + sizeof(ChunkHeader) + _maxSize), memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+
+        ptr = dataBuf + pos % bufSize + sizeof(ChunkHeader);
+    }
+    nReserved++;
+    locker.unlock();
 
-    insertPtr += _attrib.chunkSize;
+    if (overflowStarted)
+    {
+        clog << name << ": circular buffer overflow" << endl;
+    }
+    if (overflowEnded)
+    {
+        clog << name << ": recovered from overflow, " << droppedChunks << " chunk(s) dropped and "
+             << spilledChunks << " spilled so far" << endl;
+    }
+
+    return(ptr);
+}
+
+
+bool CycDataBuffer::commitChunk(int _chunkSize, ChunkAttrib _attrib)
+{
+    QMutexLocker    locker(concurrentCommit ? &reserveMutex : NULL);
+    uint32_t        size = _chunkSize;
+    uint64_t        pos = bytesIn.load(memory_order_relaxed);
+    uint64_t        occupied;
+    ChunkHeader     header;
+    Reservation*    res;
+    unsigned char*  data;
+
+    if (!nReserved)
+    {
+        cerr << "No chunk is reserved!" << endl;
+        abort();
+    }
+    res = &reserved[firstReserved];
+    firstReserved = (firstReserved + 1) % MAX_RESERVED_CHUNKS;
+    nReserved--;
+
+    if (_chunkSize > res->maxSize)
+    {
+        cerr << "The chunk is larger than the reserved space!" << endl;
+        abort();
+    }
+
+    _attrib.chunkSize = _chunkSize;
+    _attrib.isRec = (epoch ? epoch->isRec(_attrib.timestamp) : isRec.load(memory_order_relaxed));
+
+    // The chunk did not fit in the buffer. Only the chunks that are being
+    // recorded are worth spilling.
+    if (res->inScratch)
+    {
+        if (policy == OVERFLOW_SPILL && _attrib.isRec)
+        {
+            if (fwrite(&(_attrib.timestamp), sizeof(uint64_t), 1, spillFile) == 1 &&
+                fwrite(&(_attrib.blockId), sizeof(uint64_t), 1, spillFile) == 1 &&
+                fwrite(&size, sizeof(uint32_t), 1, spillFile) == 1 &&
+                fwrite(res->scratchBuf, 1, _chunkSize, spillFile) == size)
+            {
+                countOverflow(_attrib, true);
+                return(false);
+            }
+            countOverflow(_attrib, false);
+            locker.unlock();
+            cerr << name << ": error writing to the overflow file" << endl;
+            return(false);
+        }
+        countOverflow(_attrib, false);
+        return(false);
+    }
+
+    // The chunks reserved earlier may have turned out smaller than reserved.
+    // The source is addressed relative to the destination, so that both lie
+    // in the same view of the buffer.
+    if (res->pos != pos)
+    {
+        memmove(dataBuf + insertPtr + sizeof(ChunkHeader), dataBuf + insertPtr + (res->pos - pos) + sizeof(ChunkHeader), _chunkSize);
+    }
+
+    header.insertTime = LatencyHistogram::now();
+    header.attrib = _attrib;
+    memcpy(dataBuf + insertPtr, (unsigned char*)(&header), sizeof(ChunkHeader));
+
+    // Publish the chunk. The sequentially consistent store pairs with the
+    // consumer's store to consumerWaiting in waitForData(): either the
+    // consumer sees the new data or we see that it is (about to be) asleep.
+    bytesIn.store(pos + sizeof(ChunkHeader) + _chunkSize, memory_order_seq_cst);
+    if (consumerWaiting.load(memory_order_seq_cst))
+    {
+        wakeSeq.fetch_add(1, memory_order_release);
+        syscall(SYS_futex, (int*)&wakeSeq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+
+    occupied = pos + sizeof(ChunkHeader) + _chunkSize - bytesOut.load(memory_order_relaxed);
+    if (occupied > peakOccupancy.load(memory_order_relaxed))
+    {
+        peakOccupancy.store(occupied, memory_order_relaxed);
+    }
+
+    // Publish the chunk to the secondary consumers
+    uint64_t    seq = chunksIn.load(memory_order_relaxed);
+    IndexEntry& entry = chunkIndex[seq % CHUNK_INDEX_LEN];
+
+    entry.seq.store(UINT64_MAX, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    entry.pos.store(pos, memory_order_relaxed);
+    entry.seq.store(seq, memory_order_release);
+    chunksIn.store(seq + 1, memory_order_release);
+
+    data = dataBuf + insertPtr + sizeof(ChunkHeader);
+    insertPtr += sizeof(ChunkHeader) + _chunkSize;
     if(insertPtr >= bufSize)
     {
-        insertPtr = 0;
+        insertPtr -= bufSize;
     }
+    locker.unlock();
+
+    emit chunkReady(data);
+
+    return(true);
 }
 
 
 unsigned char* CycDataBuffer::getChunk(ChunkAttrib* _attrib)
 {
-    unsigned char* res;
+    // Release the chunk(s) returned by the previous call(s)
+    releasePtr = getPtr;
+    bytesReleased.store(bytesAcquired, memory_order_release);
+    publishReleased();
 
-    buffSemaphore->acquire(sizeof(ChunkAttrib));
-    memcpy((unsigned char*)_attrib, dataBuf + getPtr, sizeof(ChunkAttrib));
-    getPtr += sizeof(ChunkAttrib);
+    return(acquireChunk(_attrib));
+}
+
+
+int CycDataBuffer::getChunks(ChunkAttrib* _attribs, unsigned char** _data, int _maxChunks, uint64_t _maxBytes)
+{
+    ChunkAttrib attrib;
+    uint64_t    nBytes;
+    int         nChunks = 1;
+
+    _data[0] = getChunk(&_attribs[0]);
+    nBytes = _attribs[0].chunkSize;
+
+    // Take whatever else is ready without waiting. No chunks are skipped
+    // within a batch, so the chunk checked is the one taken.
+    while (nChunks < _maxChunks && bytesIn.load(memory_order_acquire) != bytesAcquired)
+    {
+        memcpy((unsigned char*)(&attrib), dataBuf + getPtr + offsetof(ChunkHeader, attrib), sizeof(ChunkAttrib));
+        if (nBytes + attrib.chunkSize > _maxBytes)
+        {
+            break;
+        }
+
+        _data[nChunks] = takeChunk(&_attribs[nChunks]);
+        nBytes += _attribs[nChunks].chunkSize;
+        nChunks++;
+    }
+
+    return(nChunks);
+}
+
+
+unsigned char* CycDataBuffer::acquireChunk(ChunkAttrib* _attrib)
+{
+    while (bytesIn.load(memory_order_acquire) == bytesAcquired)
+    {
+        waitForData(bytesAcquired);
+    }
+
+    // Old chunks can only be skipped if nothing is held by the consumer. The
+    // chunks may be released by another thread; the acquire load pairs with
+    // the release store in releaseChunk().
+    if (policy == OVERFLOW_CATCH_UP && bytesReleased.load(memory_order_acquire) == bytesAcquired)
+    {
+        evictOldest();
+    }
 
-    buffSemaphore->acquire(_attrib->chunkSize);
+    return(takeChunk(_attrib));
+}
+
+
+unsigned char* CycDataBuffer::takeChunk(ChunkAttrib* _attrib)
+{
+    unsigned char*  res;
+    ChunkHeader     header;
+
+    memcpy((unsigned char*)(&header), dataBuf + getPtr, sizeof(ChunkHeader));
+    *_attrib = header.attrib;
+    getPtr += sizeof(ChunkHeader);
     res = dataBuf + getPtr;
 
     getPtr += _attrib->chunkSize;
     if(getPtr >= bufSize)
     {
-        getPtr = 0;
+        getPtr -= bufSize;
     }
 
+    bytesAcquired += sizeof(ChunkHeader) + _attrib->chunkSize;
+
+    chunksOut.store(chunksOut.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    latencyHist.record(LatencyHistogram::now() - header.insertTime);
+
     return(res);
 }
 
 
+void CycDataBuffer::releaseChunk()
+{
+    ChunkAttrib attrib;
+
+    memcpy((unsigned char*)(&attrib), dataBuf + releasePtr + offsetof(ChunkHeader, attrib), sizeof(ChunkAttrib));
+
+    releasePtr += sizeof(ChunkHeader) + attrib.chunkSize;
+    if(releasePtr >= bufSize)
+    {
+        releasePtr -= bufSize;
+    }
+
+    bytesReleased.store(bytesReleased.load(memory_order_relaxed) + sizeof(ChunkHeader) + attrib.chunkSize, memory_order_release);
+    publishReleased();
+}
+
+
 void CycDataBuffer::setIsRec(bool _isRec)
 {
     isRec = _isRec;
 }
+
+
+void CycDataBuffer::setRecordingEpoch(RecordingEpoch* _epoch)
+{
+    epoch = _epoch;
+}
+
+
+void CycDataBuffer::setConcurrentCommit(bool _concurrentCommit)
+{
+    concurrentCommit = _concurrentCommit;
+}
+
+
+double CycDataBuffer::occupancy()
+{
+    uint64_t    out = bytesOut.load(memory_order_acquire);
+    uint64_t    in = bytesIn.load(memory_order_acquire);
+
+    return(in > out ? double(in - out) / bufSize : 0);
+}
+
+
+BufferStats CycDataBuffer::stats()
+{
+    BufferStats stats;
+    uint64_t    out = bytesOut.load(memory_order_acquire);
+    uint64_t    in = bytesIn.load(memory_order_acquire);
+
+    stats.size = bufSize;
+    stats.occupancy = (in > out ? in - out : 0);
+    stats.peakOccupancy = peakOccupancy.load(memory_order_relaxed);
+    stats.chunksIn = chunksIn.load(memory_order_relaxed);
+    stats.chunksOut = chunksOut.load(memory_order_relaxed);
+
+    return(stats);
+}
+
+
+const LatencyHistogram& CycDataBuffer::latency()
+{
+    return(latencyHist);
+}
+
+
+int CycDataBuffer::chunkOverhead()
+{
+    return(sizeof(ChunkHeader));
+}
+
+
+unsigned char* CycDataBuffer::readChunk(ChunkCursor* _cursor, ChunkAttrib* _attrib, bool _latest)
+{
+    uint64_t    nChunks;
+    uint64_t    seq;
+    uint64_t    pos;
+
+    for(;;)
+    {
+        nChunks = chunksIn.load(memory_order_acquire);
+        if (nChunks <= _cursor->nextSeq)
+        {
+            return(NULL);
+        }
+
+        // Chunks older than CHUNK_INDEX_LEN cannot be looked up anymore
+        if (_latest)
+        {
+            seq = nChunks - 1;
+        }
+        else
+        {
+            seq = max(_cursor->nextSeq, nChunks > CHUNK_INDEX_LEN ? nChunks - CHUNK_INDEX_LEN : 0);
+        }
+
+        // Look the chunk up; retry if the index entry is being reused
+        IndexEntry& entry = chunkIndex[seq % CHUNK_INDEX_LEN];
+        if (entry.seq.load(memory_order_acquire) != seq)
+        {
+            continue;
+        }
+        pos = entry.pos.load(memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        if (entry.seq.load(memory_order_relaxed) != seq)
+        {
+            continue;
+        }
+
+        // Read the attributes and make sure they are not torn
+        memcpy((unsigned char*)_attrib, dataBuf + pos % bufSize + offsetof(ChunkHeader, attrib), sizeof(ChunkAttrib));
+        atomic_thread_fence(memory_order_acquire);
+        if (writeLimit.load(memory_order_relaxed) > pos + bufSize)
+        {
+            // Overwritten already; skip it and try the next one
+            _cursor->missed += seq + 1 - _cursor->nextSeq;
+            _cursor->nextSeq = seq + 1;
+            continue;
+        }
+
+        _cursor->missed += seq - _cursor->nextSeq;
+        _cursor->nextSeq = seq + 1;
+        _cursor->chunkPos = pos;
+        return(dataBuf + pos % bufSize + sizeof(ChunkHeader));
+    }
+}
+
+
+bool CycDataBuffer::chunkIntact(ChunkCursor* _cursor)
+{
+    // Pairs with the release fence in reserveChunk(): if any of the data read
+    // has been written by the producer since the chunk was published, the
+    // new write limit is visible here.
+    atomic_thread_fence(memory_order_acquire);
+    if (writeLimit.load(memory_order_relaxed) > _cursor->chunkPos + bufSize)
+    {
+        _cursor->missed++;
+        return(false);
+    }
+
+    return(true);
+}
+
+
+uint64_t CycDataBuffer::placeChunk(int _maxSize)
+{
+    uint64_t    pos = bytesIn.load(memory_order_relaxed);
+    uint64_t    size = sizeof(ChunkHeader) + _maxSize;
+    bool        overlaps;
+
+    // Once committed, the chunks reserved so far end at most here
+    for (int i=0; i<nReserved; i++)
+    {
+        const Reservation& res = reserved[(firstReserved + i) % MAX_RESERVED_CHUNKS];
+        if (!res.inScratch)
+        {
+            pos += sizeof(ChunkHeader) + res.maxSize;
+        }
+    }
+
+    // Take the first gap that large between the chunks still being written.
+    // The chunks are moved down when committed, never up, so the new chunk
+    // cannot be overwritten by the ones reserved before it.
+    do
+    {
+        overlaps = false;
+        for (int i=0; i<nReserved; i++)
+        {
+            const Reservation& res = reserved[(firstReserved + i) % MAX_RESERVED_CHUNKS];
+            if (!res.inScratch && pos < res.pos + sizeof(ChunkHeader) + res.maxSize && res.pos < pos + size)
+            {
+                pos = res.pos + sizeof(ChunkHeader) + res.maxSize;
+                overlaps = true;
+            }
+        }
+    } while (overlaps);
+
+    return(pos);
+}
+
+
+bool CycDataBuffer::isFull(uint64_t _end)
+{
+    return(_end - bytesOut.load(memory_order_seq_cst) > bufSize);
+}
+
+
+bool CycDataBuffer::waitForSpace(uint64_t _end)
+{
+    struct timespec start;
+    struct timespec now;
+    struct timespec timeout;
+    int64_t         waited = 0;
+    int64_t         left;
+    int             seq;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (isFull(_end))
+    {
+        left = int64_t(timeoutMs) * 1000 - waited;
+        if (left <= 0)
+        {
+            blockedTime += waited;
+            return(false);
+        }
+        timeout.tv_sec = left / 1000000;
+        timeout.tv_nsec = (left % 1000000) * 1000;
+
+        // Same protocol as in waitForData() with the roles swapped
+        seq = spaceSeq.load(memory_order_acquire);
+        producerWaiting.store(true, memory_order_seq_cst);
+        if (isFull(_end))
+        {
+            syscall(SYS_futex, (int*)&spaceSeq, FUTEX_WAIT_PRIVATE, seq, &timeout, NULL, 0);
+        }
+        producerWaiting.store(false, memory_order_relaxed);
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        waited = (now.tv_sec - start.tv_sec) * 1000000 + (now.tv_nsec - start.tv_nsec) / 1000;
+    }
+
+    blockedTime += waited;
+    return(true);
+}
+
+
+void CycDataBuffer::publishReleased()
+{
+    if (policy != OVERFLOW_BLOCK)
+    {
+        bytesOut.store(bytesReleased.load(memory_order_relaxed), memory_order_release);
+        return;
+    }
+
+    // Pairs with the producer's store to producerWaiting in waitForSpace()
+    bytesOut.store(bytesReleased.load(memory_order_relaxed), memory_order_seq_cst);
+    if (producerWaiting.load(memory_order_seq_cst))
+    {
+        spaceSeq.fetch_add(1, memory_order_release);
+        syscall(SYS_futex, (int*)&spaceSeq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+
+void CycDataBuffer::evictOldest()
+{
+    ChunkAttrib attrib;
+    uint64_t    in = bytesIn.load(memory_order_acquire);
+    uint64_t    nEvicted = 0;
+
+    // Always keep the newest chunk
+    while (in - bytesAcquired > bufSize * OVERFLOW_EVICT_LEVEL)
+    {
+        memcpy((unsigned char*)(&attrib), dataBuf + getPtr + offsetof(ChunkHeader, attrib), sizeof(ChunkAttrib));
+        if (bytesAcquired + sizeof(ChunkHeader) + attrib.chunkSize >= in)
+        {
+            break;
+        }
+
+        getPtr += sizeof(ChunkHeader) + attrib.chunkSize;
+        if(getPtr >= bufSize)
+        {
+            getPtr -= bufSize;
+        }
+        bytesAcquired += sizeof(ChunkHeader) + attrib.chunkSize;
+
+        countOverflow(attrib, false);
+        nEvicted++;
+    }
+
+    if (nEvicted)
+    {
+        releasePtr = getPtr;
+        bytesReleased.store(bytesAcquired, memory_order_release);
+        publishReleased();
+
+        if (!evicting)
+        {
+            evicting = true;
+            overflows++;
+            clog << name << ": circular buffer overflow, skipping the oldest chunks" << endl;
+        }
+    }
+    else if (evicting && in - bytesAcquired < bufSize * OVERFLOW_RESUME_LEVEL)
+    {
+        evicting = false;
+        clog << name << ": recovered from overflow, " << droppedChunks << " chunk(s) dropped so far" << endl;
+    }
+}
+
+
+void CycDataBuffer::countOverflow(const ChunkAttrib& _attrib, bool _spilled)
+{
+    uint64_t    noTimestamp = 0;
+
+    if (_spilled)
+    {
+        spilledChunks++;
+        spilledBytes += _attrib.chunkSize;
+    }
+    else
+    {
+        droppedChunks++;
+        droppedBytes += _attrib.chunkSize;
+    }
+
+    firstDropTimestamp.compare_exchange_strong(noTimestamp, _attrib.timestamp);
+    lastDropTimestamp = _attrib.timestamp;
+}
+
+
+void CycDataBuffer::waitForData(uint64_t _bytesAcquired)
+{
+    int seq = wakeSeq.load(memory_order_acquire);
+
+    consumerWaiting.store(true, memory_order_seq_cst);
+    if (bytesIn.load(memory_order_seq_cst) == _bytesAcquired)
+    {
+        // Returns immediately if the producer has bumped wakeSeq in the meantime
+        syscall(SYS_futex, (int*)&wakeSeq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+    }
+    consumerWaiting.store(false, memory_order_relaxed);
+}
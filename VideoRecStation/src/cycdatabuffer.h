@@ -21,18 +21,66 @@
 #define CYCDATABUFFER_H_
 
 #include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <string>
 #include <QObject>
-#include <QSemaphore>
+#include <QMutex>
+
+#include "config.h"
+#include "bufferstats.h"
+#include "recordingepoch.h"
+
+class BufferArena;
 
 //! Attributes associated with each data chunk.
 typedef struct
 {
     int         chunkSize;
     uint64_t    timestamp;
+    uint64_t    blockId;        // assigned by the producer, consecutive
     bool        isRec;
 } ChunkAttrib;
 
 
+//! Read position of a secondary consumer in a CycDataBuffer.
+/*!
+ * Should be zero-initialized before the first use. See
+ * CycDataBuffer::readChunk().
+ */
+typedef struct
+{
+    uint64_t    nextSeq;        // sequence number of the next chunk to be read
+    uint64_t    chunkPos;       // position of the last chunk returned
+    uint64_t    missed;         // chunks skipped or overwritten while being read
+} ChunkCursor;
+
+
+//! What a CycDataBuffer does when a new chunk does not fit in it.
+enum OverflowPolicy
+{
+    OVERFLOW_ABORT,         // abort the program
+    OVERFLOW_BLOCK,         // wait for the primary consumer, drop the chunk after a timeout
+    OVERFLOW_DROP_NEWEST,   // drop the chunk being inserted
+    OVERFLOW_CATCH_UP,      // the primary consumer skips the backlog, otherwise drop the chunk being inserted
+    OVERFLOW_SPILL          // write the chunk to an overflow file instead
+};
+
+
+//! Overflow statistics of a CycDataBuffer.
+typedef struct
+{
+    uint64_t    overflows;          // number of times the buffer got full
+    uint64_t    droppedChunks;
+    uint64_t    droppedBytes;
+    uint64_t    spilledChunks;
+    uint64_t    spilledBytes;
+    uint64_t    blockedTime;        // time the producer waited for space, in microseconds
+    uint64_t    firstTimestamp;     // timestamp of the first chunk dropped or spilled, 0 if none
+    uint64_t    lastTimestamp;      // timestamp of the last chunk dropped or spilled
+} OverflowStats;
+
+
 //! Cyclic buffer capable of holding data chunks of variable size.
 /*!
  * Cyclic buffer for synchronizing producer/consumer threads. Supports single
@@ -41,18 +89,43 @@ typedef struct
  * respectively. No additional synchronization between the producer and the
  * primary consumer is needed - the buffer takes care of it.
  *
- * Secondary consumers are only notified of every new chunk inserted trough
- * chunkReady() signal. The buffer provides no hard guaranty that the data will
- * not be overwritten before secondary consumers access it, but if the buffer
- * is large enough in comparison to the chunk insertion rate, the secondary
- * consumers are fast enough and the are general system load is low enough,
- * this should not typically happen.
+ * Instead of handing a ready chunk to insertChunk() the producer can also
+ * write the chunk directly into the buffer: reserveChunk() returns a pointer
+ * to free space large enough for a chunk of the given maximal size, and
+ * commitChunk() publishes the chunk once it has been written. This saves one
+ * copy of the data.
+ *
+ * Secondary consumers are notified of every new chunk inserted trough
+ * chunkReady() signal and read the chunks with readChunk(), each keeping its
+ * own ChunkCursor. Secondary consumers never hold back the producer, so a
+ * chunk can be overwritten while a slow secondary consumer is still reading
+ * it. Every chunk gets a sequence number, and the producer announces which
+ * part of the buffer it is about to write to before writing it (as in a
+ * seqlock). readChunk() skips the chunks that have already been overwritten,
+ * and chunkIntact() tells after the fact whether the chunk was overwritten
+ * while the consumer was reading it, in which case the consumer should
+ * discard whatever it has decoded. The cursor counts the chunks the consumer
+ * has missed.
  *
  * Neither primary nor secondary consumers should modify the content of the
  * data chunks.
  *
  * The class assumes that in general the primary consumer is considerably
  * faster than the producer, so that buffer is nearly empty most of the time.
+ * What happens if the buffer gets full anyway is selected with
+ * setOverflowPolicy(); by default the program is aborted.
+ *
+ * Producer and primary consumer do not share any locks. They communicate
+ * through two monotonically growing byte counters (bytes published by the
+ * producer and bytes released by the consumer) using acquire/release
+ * ordering. The primary consumer only sleeps (on a futex) when the buffer is
+ * empty, and the producer only makes a system call when it knows that the
+ * consumer is sleeping, or when it waits for space with OVERFLOW_BLOCK.
+ *
+ * The buffer memory is mapped twice, back to back, so a chunk that runs past
+ * the end of the buffer continues seamlessly in the second view of its
+ * beginning. Chunks are thus always contiguous and packed without gaps, and
+ * the whole buffer can be filled.
  */
 class CycDataBuffer : public QObject
 {
@@ -60,38 +133,283 @@ class CycDataBuffer : public QObject
 
 public:
     /*!
-     * Buffer size is in bytes. Due to implementation details (semaphore counts
-     * bytes rather than chunks) buffer size is limited by the size of "int" on
-     * your platform.
+     * Buffer size is in bytes; it is rounded up to a multiple of the page
+     * size. Any chunk up to the size of the whole buffer can be inserted.
+     * The memory is mapped and prefaulted in the constructor, so that the
+     * producer never takes a page fault when inserting a chunk. If
+     * _hugePages is true, the buffer is backed by explicit (hugetlbfs) huge
+     * pages if any are reserved in the system, and by transparent huge pages
+     * otherwise. If _lockMemory is true, the buffer is locked in RAM (subject
+     * to RLIMIT_MEMLOCK).
      */
-    CycDataBuffer(int _bufSize);
+    CycDataBuffer(uint64_t _bufSize, bool _hugePages=false, bool _lockMemory=false);
+
+    /*!
+     * Create a buffer in a slice of _arena (see BufferArena). The size is
+     * rounded up to the arena's granularity. If the arena does not have
+     * enough free space, the buffer allocates memory of its own instead.
+     */
+    CycDataBuffer(BufferArena* _arena, uint64_t _bufSize);
     virtual ~CycDataBuffer();
-    void insertChunk(unsigned char* _data, ChunkAttrib _attrib);
+
+    /*!
+     * Select what happens when the buffer overflows. Should be called before
+     * any chunks are inserted. _name identifies the buffer in the log and in
+     * the name of the overflow file. _timeoutMs is the maximal time the
+     * producer waits for space with OVERFLOW_BLOCK. With OVERFLOW_SPILL the
+     * chunks that do not fit and should be recorded are appended to an
+     * overflow file in the _spillPath folder (preferably on a different disk
+     * than the recordings), each as a timestamp (uint64), block ID (uint64),
+     * size (uint32) and the data. With OVERFLOW_CATCH_UP the primary
+     * consumer discards the oldest chunks it has not acquired yet whenever
+     * the buffer is more than OVERFLOW_EVICT_LEVEL full. It only does that
+     * when it acquires a chunk while holding none, so the producer is not
+     * helped while the consumer is busy (e.g. stuck in a slow write); if the
+     * buffer overflows meanwhile, the chunk being inserted is dropped as with
+     * OVERFLOW_DROP_NEWEST.
+     */
+    void setOverflowPolicy(OverflowPolicy _policy, const char* _name, int _timeoutMs=0, const char* _spillPath=NULL);
+
+    //! Overflow statistics so far. Can be called from any thread.
+    OverflowStats overflowStats();
+
+    /*!
+     * Copy the chunk to the buffer. Return false if the chunk has been
+     * dropped or spilled because of an overflow.
+     */
+    bool insertChunk(unsigned char* _data, ChunkAttrib _attrib);
+
+    /*!
+     * Reserve space for a chunk of at most _maxSize bytes and return a pointer
+     * to it. The producer should write the chunk's data there and then call
+     * commitChunk(). Up to MAX_RESERVED_CHUNKS chunks can be reserved at a
+     * time; they are committed in the order they were reserved. Reserving
+     * and committing can only happen in different threads (still only one
+     * thread reserving) after setConcurrentCommit(true).
+     */
+    unsigned char* reserveChunk(int _maxSize);
+
+    /*!
+     * Publish the oldest chunk reserved with reserveChunk() and not committed
+     * yet. _chunkSize is the actual size of the chunk and should not exceed
+     * the reserved size; chunkSize field of _attrib is ignored. Return false
+     * if the chunk has been dropped or spilled because of an overflow. If
+     * the chunks reserved before this one turned out to be smaller than
+     * reserved, the chunk's data is moved down to close the gap.
+     */
+    bool commitChunk(int _chunkSize, ChunkAttrib _attrib);
 
     /*!
      * Acquire a chunk and return a pointer to it. The chunk is implicitly
      * released next time getChunk is called.
      */
     unsigned char* getChunk(ChunkAttrib* _attrib);
+
+    /*!
+     * Acquire a batch of consecutive chunks that are ready, waiting for at
+     * least one. At most _maxChunks chunks with the total data size of at
+     * most _maxBytes are acquired (but always at least one chunk). The
+     * attributes of the chunks are copied to _attribs and the pointers to
+     * their data are stored in _data. Return the number of chunks acquired.
+     * Like with getChunk(), the chunks are implicitly released next time
+     * getChunk() or getChunks() is called. With OVERFLOW_CATCH_UP the oldest
+     * chunks can only be skipped before the first chunk of a batch.
+     */
+    int getChunks(ChunkAttrib* _attribs, unsigned char** _data, int _maxChunks, uint64_t _maxBytes);
+
+    /*!
+     * Acquire a chunk without releasing the previously acquired ones. The
+     * chunks acquired this way should be released with releaseChunk().
+     */
+    unsigned char* acquireChunk(ChunkAttrib* _attrib);
+
+    /*!
+     * Release the oldest chunk acquired with acquireChunk() and not released
+     * yet. Chunks are always released in the order they were acquired. The
+     * method can be called from a thread other than the one acquiring the
+     * chunks, as long as the calls are serialized with respect to each other.
+     */
+    void releaseChunk();
     void setIsRec(bool _isRec);
 
+    /*!
+     * Decide whether a chunk is recorded by comparing its timestamp against
+     * _epoch instead of using the flag set with setIsRec(). Should be called
+     * before any chunks are inserted.
+     */
+    void setRecordingEpoch(RecordingEpoch* _epoch);
+
+    /*!
+     * Let the chunks be reserved and committed in different threads. The
+     * producer's state is then guarded by a mutex, which the committing
+     * threads share with the reserving one (but never with the consumers).
+     * By default the producer is a single thread and takes no locks. Should
+     * be called before any chunks are inserted.
+     */
+    void setConcurrentCommit(bool _concurrentCommit);
+
+    //! Fraction (0..1) of the buffer occupied by unreleased chunks. Can be called from any thread.
+    double occupancy();
+
+    //! Occupancy statistics (in bytes) so far. Can be called from any thread.
+    BufferStats stats();
+
+    /*!
+     * Histogram of the time (in microseconds) the chunks spent in the buffer
+     * between being published by the producer and acquired by the primary
+     * consumer. Can be read from any thread.
+     */
+    const LatencyHistogram& latency();
+
+    //! Bytes taken in the buffer by every chunk in addition to its data.
+    static int chunkOverhead();
+
+    /*!
+     * Secondary consumer interface. Return a pointer to the oldest chunk not
+     * read through _cursor yet that has not been overwritten, or, if _latest
+     * is true, to the newest chunk. Return NULL if there is no new chunk.
+     * The chunks passed over are added to the cursor's missed count. The
+     * returned data can be overwritten by the producer at any time; call
+     * chunkIntact() after reading it.
+     */
+    unsigned char* readChunk(ChunkCursor* _cursor, ChunkAttrib* _attrib, bool _latest=false);
+
+    /*!
+     * Return true if the chunk last returned by readChunk() for _cursor has
+     * not been (even partially) overwritten so far. Otherwise count the
+     * chunk as missed and return false.
+     */
+    bool chunkIntact(ChunkCursor* _cursor);
+
 signals:
     /*!
      * This signal is raised when a new chunk of data has been copied to the
      * buffer. _data points to the chunk's data. The corresponding ChunkAttrib
-     * structure is placed immediately before _data.
+     * structure is placed immediately before _data. Secondary consumers
+     * should not read the data through _data but with readChunk().
      */
     void chunkReady(unsigned char* _data);
 
 private:
-    volatile bool   isRec;
+    // Stored in the buffer in front of every chunk's data. The attributes
+    // come last, immediately before the data.
+    typedef struct
+    {
+        uint64_t    insertTime;         // monotonic, in microseconds
+        ChunkAttrib attrib;
+    } ChunkHeader;
+
+    // A chunk reserved by the producer and not committed yet
+    typedef struct
+    {
+        uint64_t        pos;            // position of the chunk's header
+        int             maxSize;
+        bool            inScratch;      // the chunk is in scratchBuf rather than in the buffer
+        unsigned char*  scratchBuf;     // receives the chunk if it is to be dropped or spilled
+        int             scratchSize;
+    } Reservation;
+
+    //! Initialize the members, common to all constructors.
+    void init();
+
+    //! Allocate and map memory of the buffer's own.
+    void allocate(uint64_t _bufSize, bool _hugePages, bool _lockMemory);
+
+    //! Fault (or lock) the pages of the buffer in.
+    void prefault(bool _lockMemory);
+
+    //! Put the primary consumer to sleep until the producer publishes more data.
+    void waitForData(uint64_t _bytesAcquired);
+
+    //! Find a place for a chunk of at most _maxSize bytes after the chunks reserved so far.
+    uint64_t placeChunk(int _maxSize);
+
+    //! Return true if the buffer does not extend to position _end.
+    bool isFull(uint64_t _end);
+
+    //! Wait until the buffer extends to position _end. Return false on timeout.
+    bool waitForSpace(uint64_t _end);
+
+    //! Publish the primary consumer's releases and wake up the producer if it is waiting for space.
+    void publishReleased();
+
+    //! Acquire the oldest chunk not acquired yet, which should be published already.
+    unsigned char* takeChunk(ChunkAttrib* _attrib);
+
+    //! Discard the oldest chunks not acquired yet (OVERFLOW_CATCH_UP).
+    void evictOldest();
+
+    //! Account for a dropped or spilled chunk.
+    void countOverflow(const ChunkAttrib& _attrib, bool _spilled);
+
+    std::atomic<bool>       isRec;
+    RecordingEpoch*         epoch;              // NULL if isRec is used
+
+    // Shared between the producer and the primary consumer. Both counters
+    // only grow; their difference is the number of bytes occupied in the
+    // buffer.
+    std::atomic<uint64_t>   bytesIn;            // published by the producer
+    std::atomic<uint64_t>   bytesOut;           // released by the primary consumer
+    std::atomic<int>        wakeSeq;            // futex word the consumer sleeps on
+    std::atomic<bool>       consumerWaiting;
+    std::atomic<int>        spaceSeq;           // futex word the producer sleeps on
+    std::atomic<bool>       producerWaiting;
+
+    // Shared between the producer and the secondary consumers. Positions are
+    // in the same units as bytesIn; the offset in dataBuf is the position
+    // modulo bufSize.
+    typedef struct
+    {
+        std::atomic<uint64_t>   seq;            // sequence number of the chunk
+        std::atomic<uint64_t>   pos;            // position of the chunk's attributes
+    } IndexEntry;
+
+    IndexEntry*             chunkIndex;         // CHUNK_INDEX_LEN newest chunks
+    std::atomic<uint64_t>   chunksIn;           // number of chunks published
+    std::atomic<uint64_t>   writeLimit;         // end of the area the producer may be writing
+
+    // Overflow handling
+    OverflowPolicy          policy;
+    std::string             name;
+    int                     timeoutMs;
+    FILE*                   spillFile;
+    std::string             spillFileName;
+    std::atomic<uint64_t>   overflows;
+    std::atomic<uint64_t>   droppedChunks;
+    std::atomic<uint64_t>   droppedBytes;
+    std::atomic<uint64_t>   spilledChunks;
+    std::atomic<uint64_t>   spilledBytes;
+    std::atomic<uint64_t>   blockedTime;
+    std::atomic<uint64_t>   firstDropTimestamp;
+    std::atomic<uint64_t>   lastDropTimestamp;
+
+    // Statistics
+    std::atomic<uint64_t>   peakOccupancy;      // updated by the producer
+    std::atomic<uint64_t>   chunksOut;          // updated by the primary consumer
+    LatencyHistogram        latencyHist;
+
+    unsigned char*  dataBuf;            // mapped twice, see allocate()
+    uint64_t        bufSize;
+    BufferArena*    arena;              // NULL if the memory is not from an arena
+    uint64_t        arenaOffset;
+    bool            locked;
 
-    QSemaphore*     buffSemaphore;  // counts number of bytes available for reading
-    unsigned char*  dataBuf;
+    // Producer's private state. If the chunks are reserved and committed in
+    // different threads, the state is protected by reserveMutex.
+    bool            concurrentCommit;
+    QMutex          reserveMutex;
+    uint64_t        insertPtr;
+    Reservation     reserved[MAX_RESERVED_CHUNKS];  // in the order of reservation
+    int             firstReserved;
+    int             nReserved;
+    bool            overflowing;
 
-    int             insertPtr;
-    int             getPtr;
-    int             bufSize;
+    // Primary consumer's private state
+    uint64_t        getPtr;
+    uint64_t        bytesAcquired;
+    uint64_t        releasePtr;         // oldest acquired chunk not released yet
+    std::atomic<uint64_t> bytesReleased;    // also read by the thread acquiring the chunks
+    bool            evicting;           // dropping the oldest chunks (OVERFLOW_CATCH_UP)
 };
 
 #endif /* CYCDATABUFFER_H_ */
@@ -0,0 +1,253 @@
+/*
+ * directfile.cpp
+ *
+ * Author: Andrey Zhdanov
+ * Copyright (C) 2014 BioMag Laboratory, Helsinki University Central Hospital
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <iostream>
+#include <algorithm>
+
+#include "config.h"
+#include "directfile.h"
+
+using namespace std;
+
+
+DirectFile::DirectFile(IoEngine* _ioEngine)
+{
+    ioEngine = _ioEngine;
+    fd = -1;
+    curBuffer = 0;
+    curLen = 0;
+    fileLen = 0;
+    doneLen = 0;
+    failed = false;
+    flushData = NULL;
+    flushOffset = 0;
+    stopping = false;
+
+    for (int i=0; i<2; i++)
+    {
+        if (posix_memalign((void**)&(buffers[i]), DIRECT_IO_ALIGNMENT, DIRECT_IO_BUFFER_SIZE))
+        {
+            cerr << "Cannot allocate memory!" << endl;
+            abort();
+        }
+    }
+
+    // No buffer is being written yet
+    flushDone.release();
+
+    flusher = new Flusher(this);
+    flusher->start();
+}
+
+
+DirectFile::~DirectFile()
+{
+    if (fd >= 0)
+    {
+        close();
+    }
+
+    stopping = true;
+    flushQueued.release();
+    flusher->stop();
+    delete flusher;
+
+    free(buffers[1]);
+    free(buffers[0]);
+}
+
+
+int DirectFile::open(const char* _name)
+{
+    fd = ::open(_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd < 0 && errno == EINVAL)
+    {
+        cerr << "O_DIRECT is not supported for " << _name << ", writing through the page cache" << endl;
+        fd = ::open(_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    }
+
+    curLen = 0;
+    fileLen = 0;
+    doneLen = 0;
+    failed = false;
+    return(fd);
+}
+
+
+bool DirectFile::write(const struct iovec* _iov, int _iovCnt)
+{
+    unsigned char*  src;
+    uint64_t        len;
+    uint64_t        n;
+
+    if (failed)
+    {
+        return(false);
+    }
+
+    for (int i=0; i<_iovCnt; i++)
+    {
+        src = (unsigned char*)_iov[i].iov_base;
+        len = _iov[i].iov_len;
+
+        while (len > 0)
+        {
+            n = min(len, DIRECT_IO_BUFFER_SIZE - curLen);
+            memcpy(buffers[curBuffer] + curLen, src, n);
+            curLen += n;
+            src += n;
+            len -= n;
+
+            if (curLen == DIRECT_IO_BUFFER_SIZE)
+            {
+                flush();
+            }
+        }
+    }
+
+    return(!failed);
+}
+
+
+bool DirectFile::close()
+{
+    uint64_t    padded;
+    bool        ok;
+
+    // Wait for the other buffer, then write out the tail padded to a whole
+    // block and cut the padding off
+    flushDone.acquire();
+    if (curLen)
+    {
+        padded = (curLen + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+        memset(buffers[curBuffer] + curLen, 0, padded - curLen);
+        writeBlock(buffers[curBuffer], padded, fileLen);
+        fileLen += curLen;
+        curLen = 0;
+    }
+    ok = !failed;
+    flushDone.release();
+
+    // After a failure keep only the data written before it, rather than
+    // filling the rest of the file with zeros
+    if (ftruncate(fd, ok ? fileLen : doneLen))
+    {
+        cerr << "Error truncating the file: " << strerror(errno) << endl;
+    }
+    ::close(fd);
+    fd = -1;
+    return(ok);
+}
+
+
+void DirectFile::flush()
+{
+    // Wait until the flusher is done with the other buffer
+    flushDone.acquire();
+    flushData = buffers[curBuffer];
+    flushOffset = fileLen;
+    flushQueued.release();
+
+    fileLen += curLen;
+    curBuffer = 1 - curBuffer;
+    curLen = 0;
+}
+
+
+bool DirectFile::writeBlock(unsigned char* _data, uint64_t _len, uint64_t _offset)
+{
+    struct iovec    iov;
+    ssize_t         res;
+
+    // Blocks past a failed one would leave a gap in the file
+    if (failed)
+    {
+        return(false);
+    }
+
+    if (ioEngine)
+    {
+        iov.iov_base = _data;
+        iov.iov_len = _len;
+        if (!ioEngine->write(fd, _offset, &iov, 1))
+        {
+            cerr << "Error writing to the file" << endl;
+            failed = true;
+            return(false);
+        }
+    }
+    else
+    {
+        do
+        {
+            res = pwrite(fd, _data, _len, _offset);
+        } while (res < 0 && errno == EINTR);
+
+        // The remainder of a short write would not be aligned for O_DIRECT
+        if (res < 0)
+        {
+            cerr << "Error writing to the file: " << strerror(errno) << endl;
+            failed = true;
+            return(false);
+        }
+        if (uint64_t(res) != _len)
+        {
+            cerr << "Error writing to the file: wrote " << res << " bytes out of " << _len << endl;
+            failed = true;
+            return(false);
+        }
+    }
+
+    doneLen = _offset + _len;
+    return(true);
+}
+
+
+DirectFile::Flusher::Flusher(DirectFile* _file)
+{
+    file = _file;
+}
+
+
+DirectFile::Flusher::~Flusher()
+{
+}
+
+
+void DirectFile::Flusher::stoppableRun()
+{
+    while (true)
+    {
+        file->flushQueued.acquire();
+        if (file->stopping)
+        {
+            return;
+        }
+
+        file->writeBlock(file->flushData, DIRECT_IO_BUFFER_SIZE, file->flushOffset);
+        file->flushDone.release();
+    }
+}
@@ -0,0 +1,112 @@
+/*
+ * directfile.h
+ *
+ * Author: Andrey Zhdanov
+ * Copyright (C) 2014 BioMag Laboratory, Helsinki University Central Hospital
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef DIRECTFILE_H_
+#define DIRECTFILE_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <sys/uio.h>
+#include <QSemaphore>
+
+#include "stoppablethread.h"
+#include "ioengine.h"
+
+//! Output file written with O_DIRECT through double-buffered staging.
+/*!
+ * The data is copied into one of two DIRECT_IO_BUFFER_SIZE staging buffers
+ * aligned to DIRECT_IO_ALIGNMENT. A full buffer is handed to the flusher
+ * thread, which writes it to the file bypassing the page cache, while the
+ * other buffer is being filled. The caller only waits for the disk if both
+ * buffers are full.
+ *
+ * The last, partially filled buffer is padded to DIRECT_IO_ALIGNMENT and
+ * written when the file is closed; the file is then truncated to the length
+ * of the data written. If the file system does not support O_DIRECT, the
+ * file is written through the page cache, still from the flusher thread.
+ *
+ * If _ioEngine is not NULL, the flusher writes through it.
+ *
+ * A failed, short or empty write of a buffer is not retried (the rest of an
+ * O_DIRECT write would no longer be aligned). Nothing more is written to the
+ * file after a failure, and write() and close() return false; on close the
+ * file is truncated to the data written before the failure.
+ */
+class DirectFile
+{
+public:
+    DirectFile(IoEngine* _ioEngine = NULL);
+    virtual ~DirectFile();
+
+    //! Create (or truncate) the file. Return the file descriptor, or -1 on error.
+    int open(const char* _name);
+
+    /*!
+     * Append the _iovCnt buffers in _iov to the file. Return false if
+     * writing the file has failed (the failure is reported by the first call
+     * after the flusher has hit it).
+     */
+    bool write(const struct iovec* _iov, int _iovCnt);
+
+    /*!
+     * Write out the remaining data, truncate the file to its length and
+     * close it. Return false if writing the file has failed.
+     */
+    bool close();
+
+private:
+    class Flusher : public StoppableThread
+    {
+    public:
+        Flusher(DirectFile* _file);
+        virtual ~Flusher();
+
+    protected:
+        virtual void stoppableRun();
+
+    private:
+        DirectFile* file;
+    };
+
+    //! Hand the current buffer to the flusher and switch to the other one.
+    void flush();
+
+    //! Write _len bytes (a multiple of DIRECT_IO_ALIGNMENT) at _offset. Return false on error.
+    bool writeBlock(unsigned char* _data, uint64_t _len, uint64_t _offset);
+
+    IoEngine*       ioEngine;
+    int             fd;
+    unsigned char*  buffers[2];
+    int             curBuffer;
+    uint64_t        curLen;         // bytes in the current buffer
+    uint64_t        fileLen;        // bytes written and handed to the flusher
+    uint64_t        doneLen;        // bytes on the disk before the first failure
+    std::atomic<bool>   failed;
+
+    // Buffer being written by the flusher
+    unsigned char*  flushData;
+    uint64_t        flushOffset;
+    QSemaphore      flushQueued;
+    QSemaphore      flushDone;
+    volatile bool   stopping;
+    Flusher*        flusher;
+};
+
+#endif /* DIRECTFILE_H_ */
@@ -18,12 +18,20 @@
  */
 
 #include <iostream>
-#include <fstream>
+#include <algorithm>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <QFileInfo>
 
+#include "config.h"
 #include "filewriter.h"
 
 using namespace std;
@@ -32,6 +40,24 @@ FileWriter::FileWriter(CycDataBuffer* _cycBuf, const char* _path, const char* _s
 {
     cycBuf = _cycBuf;
     streamId = _streamId;
+    bytesWritten = 0;
+    writeTime = 0;
+    preRoll = 0;
+    preRollBytes = 0;
+    ioEngine = NULL;
+    directIo = false;
+    directFile = NULL;
+    extentSize = 0;
+    dirtyWindow = 0;
+    writeIndex = false;
+    indexFd = -1;
+    allocatedLen = 0;
+    syncedLen = 0;
+    cleanLen = 0;
+    prevIsRec = false;
+    outFd = -1;
+    fileOffset = 0;
+    writeFailed = false;
 
     path = (char*)malloc(strlen(_path)+1);
     if(!path)
@@ -62,30 +88,251 @@ FileWriter::FileWriter(CycDataBuffer* _cycBuf, const char* _path, const char* _s
 
 FileWriter::~FileWriter()
 {
+    delete directFile;
     free(ext);
     free(suffix);
     free(path);
 }
 
 
+//! Write all the buffers in _iov to _fd, resuming after partial writes. Return false on error.
+static bool writeAll(int _fd, struct iovec* _iov, int _iovCnt)
+{
+    ssize_t res;
+
+    while (_iovCnt > 0)
+    {
+        res = writev(_fd, _iov, min(_iovCnt, IOV_MAX));
+        if (res < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            cerr << "Error writing to the file: " << strerror(errno) << endl;
+            return(false);
+        }
+
+        // Nothing written although there is data left (empty buffers are
+        // skipped below)
+        if (res == 0 && _iov->iov_len > 0)
+        {
+            cerr << "Error writing to the file: nothing written" << endl;
+            return(false);
+        }
+
+        // Skip the buffers (or parts of them) that have been written
+        while (_iovCnt > 0 && size_t(res) >= _iov->iov_len)
+        {
+            res -= _iov->iov_len;
+            _iov++;
+            _iovCnt--;
+        }
+        if (_iovCnt > 0)
+        {
+            _iov->iov_base = (char*)_iov->iov_base + res;
+            _iov->iov_len -= res;
+        }
+    }
+
+    return(true);
+}
+
+
 void FileWriter::stoppableRun()
 {
-    unsigned char*  databuf;
-    bool            prevIsRec=false;
-    ofstream        outData;
-    char            nameBuf[500];
+    ChunkAttrib     attribs[WRITE_BATCH_CHUNKS];
+    unsigned char*  chunks[WRITE_BATCH_CHUNKS];
+    int             nChunks;
+    int             lastRec;
+
+    while (true)
+    {
+        if (preRoll && !prevIsRec)
+        {
+            holdPreRoll();
+        }
+        else
+        {
+            nChunks = cycBuf->getChunks(attribs, chunks, WRITE_BATCH_CHUNKS, WRITE_BATCH_BYTES);
+            writeBatch(attribs, chunks, nChunks);
+
+            // Recording has stopped: release the chunks up to the last one
+            // recorded and keep the rest as the pre-roll of the next recording
+            if (preRoll && !prevIsRec)
+            {
+                lastRec = nChunks - 1;
+                while (lastRec >= 0 && !attribs[lastRec].isRec)
+                {
+                    lastRec--;
+                }
+                for (int i=0; i<nChunks; i++)
+                {
+                    if (i <= lastRec)
+                    {
+                        cycBuf->releaseChunk();
+                    }
+                    else
+                    {
+                        addPreRoll(attribs[i], chunks[i]);
+                    }
+                }
+            }
+        }
+
+        if(shouldStop)
+        {
+            if(prevIsRec)
+            {
+                closeFile();
+            }
+            return;
+        }
+    }
+}
+
+
+void FileWriter::holdPreRoll()
+{
+    ChunkAttrib     attrib;
+    unsigned char*  data;
+    ChunkAttrib     attribs[WRITE_BATCH_CHUNKS];
+    unsigned char*  chunks[WRITE_BATCH_CHUNKS];
+    int             nChunks = 0;
+
+    data = cycBuf->acquireChunk(&attrib);
+    if (!attrib.isRec)
+    {
+        addPreRoll(attrib, data);
+        return;
+    }
+
+    // Recording has started: write out the pre-roll straight from the
+    // buffer, followed by the first chunk recorded. The chunks stay acquired
+    // until the next getChunks() call.
+    trimPreRoll(attrib.timestamp);
+    for (deque<PreRollChunk>::iterator it = preRollChunks.begin(); it != preRollChunks.end(); it++)
+    {
+        attribs[nChunks] = it->attrib;
+        attribs[nChunks].isRec = true;
+        chunks[nChunks++] = it->data;
+        if (nChunks == WRITE_BATCH_CHUNKS)
+        {
+            writeBatch(attribs, chunks, nChunks);
+            nChunks = 0;
+        }
+    }
+    attribs[nChunks] = attrib;
+    chunks[nChunks++] = data;
+    writeBatch(attribs, chunks, nChunks);
+
+    preRollChunks.clear();
+    preRollBytes = 0;
+}
+
+
+void FileWriter::addPreRoll(const ChunkAttrib& _attrib, unsigned char* _data)
+{
+    PreRollChunk    chunk;
+
+    chunk.attrib = _attrib;
+    chunk.data = _data;
+    preRollChunks.push_back(chunk);
+    preRollBytes += CycDataBuffer::chunkOverhead() + _attrib.chunkSize;
+    trimPreRoll(_attrib.timestamp);
+}
+
+
+void FileWriter::trimPreRoll(uint64_t _timestamp)
+{
+    // Give back the chunks that have fallen out of the pre-roll window. If
+    // the buffer is getting full, history is sacrificed before it overflows.
+    while (!preRollChunks.empty() &&
+           (preRollChunks.front().attrib.timestamp + preRoll < _timestamp || cycBuf->occupancy() > PRE_ROLL_MAX_LEVEL))
+    {
+        preRollBytes -= CycDataBuffer::chunkOverhead() + preRollChunks.front().attrib.chunkSize;
+        preRollChunks.pop_front();
+        cycBuf->releaseChunk();
+    }
+}
+
+
+void FileWriter::writeBatch(ChunkAttrib* _attribs, unsigned char** _chunks, int _nChunks)
+{
     time_t          timeNow;
     struct tm*      timeNowParsed;
-    ChunkAttrib     chunkAttrib;
-    uint32_t        chunkSz;
+    struct timespec writeStart;
+    struct timespec writeEnd;
 
     unsigned char*  header;
     int             headerLen;
 
-    while (true)
+    // Every batch of chunks is written with a single system call. Each chunk
+    // is stored as timestamp, block ID, size and data.
+    unsigned char   chunkHeaders[WRITE_BATCH_CHUNKS][CHUNK_HEADER_SIZE];
+    uint32_t        chunkSize;
+    struct iovec    iov[2 * WRITE_BATCH_CHUNKS + 1];
+    int             nIov = 0;
+    uint64_t        batchBytes = 0;
+    IndexEntry      index[WRITE_BATCH_CHUNKS];
+    int             nIndex = 0;
+    bool            ok;
+
+    for (int i=0; i<=_nChunks; i++)
     {
-        databuf = cycBuf->getChunk(&chunkAttrib);
-        if (chunkAttrib.isRec)
+        // Write out what has been collected before the file is closed and
+        // at the end of the batch. After a failed write the rest of the
+        // recording is dropped.
+        if (nIov && (i == _nChunks || !_attribs[i].isRec))
+        {
+            if (!writeFailed)
+            {
+                clock_gettime(CLOCK_MONOTONIC, &writeStart);
+                preallocate(fileOffset + batchBytes);
+                if (directFile)
+                {
+                    ok = directFile->write(iov, nIov);
+                }
+                else if (ioEngine)
+                {
+                    // The engine writes at explicit offsets
+                    ok = ioEngine->write(outFd, fileOffset, iov, nIov);
+                }
+                else
+                {
+                    ok = writeAll(outFd, iov, nIov);
+                }
+
+                if (ok)
+                {
+                    fileOffset += batchBytes;
+                    limitDirtyPages();
+                    if (nIndex)
+                    {
+                        writeIndexEntries(index, nIndex);
+                    }
+                    clock_gettime(CLOCK_MONOTONIC, &writeEnd);
+
+                    bytesWritten += batchBytes;
+                    writeTime += (writeEnd.tv_sec - writeStart.tv_sec) * 1000000 + (writeEnd.tv_nsec - writeStart.tv_nsec) / 1000;
+                }
+                else
+                {
+                    cerr << "Error writing to the file " << nameBuf << ", not writing the rest of the recording" << endl;
+                    writeFailed = true;
+                }
+            }
+            nIov = 0;
+            batchBytes = 0;
+            nIndex = 0;
+        }
+
+        if (i == _nChunks)
+        {
+            break;
+        }
+
+        if (_attribs[i].isRec)
         {
             if (!prevIsRec)
             {
@@ -103,8 +350,19 @@ void FileWriter::stoppableRun()
                         suffix,
                         streamId,
                         ext);
-                outData.open(nameBuf, ios_base::out | ios_base::binary | ios_base::trunc);
-                if(outData.fail())
+                if (directIo)
+                {
+                    if (!directFile)
+                    {
+                        directFile = new DirectFile(ioEngine);
+                    }
+                    outFd = directFile->open(nameBuf);
+                }
+                else
+                {
+                    outFd = open(nameBuf, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+                }
+                if(outFd < 0)
                 {
                     // TODO: Add more elaborate error checking
                     cerr << "Error opening the file " << nameBuf << endl;
@@ -112,39 +370,224 @@ void FileWriter::stoppableRun()
                 }
                 readableFileName = QFileInfo(nameBuf).fileName();
                 header = getHeader(&headerLen);
-                outData.write((const char*)header, headerLen);
+                iov[nIov].iov_base = header;
+                iov[nIov++].iov_len = headerLen;
+                batchBytes += headerLen;
+                fileOffset = 0;
+                allocatedLen = 0;
+                syncedLen = 0;
+                cleanLen = 0;
+                writeFailed = false;
+                if (writeIndex)
+                {
+                    openIndex();
+                }
             }
 
-            chunkSz = chunkAttrib.chunkSize;
-            outData.write((const char*)(&(chunkAttrib.timestamp)), sizeof(uint64_t));
-            outData.write((const char*)(&chunkSz), sizeof(uint32_t));
-            outData.write((const char*)databuf, chunkAttrib.chunkSize);
+            if (indexFd >= 0)
+            {
+                index[nIndex].timestamp = _attribs[i].timestamp;
+                index[nIndex].blockId = _attribs[i].blockId;
+                index[nIndex].offset = fileOffset + batchBytes + CHUNK_HEADER_SIZE;
+                index[nIndex++].size = _attribs[i].chunkSize;
+            }
+
+            chunkSize = _attribs[i].chunkSize;
+            memcpy(chunkHeaders[i], &(_attribs[i].timestamp), sizeof(uint64_t));
+            memcpy(chunkHeaders[i] + sizeof(uint64_t), &(_attribs[i].blockId), sizeof(uint64_t));
+            memcpy(chunkHeaders[i] + 2*sizeof(uint64_t), &chunkSize, sizeof(uint32_t));
+            iov[nIov].iov_base = chunkHeaders[i];
+            iov[nIov++].iov_len = CHUNK_HEADER_SIZE;
+            iov[nIov].iov_base = _chunks[i];
+            iov[nIov++].iov_len = chunkSize;
+            batchBytes += CHUNK_HEADER_SIZE + chunkSize;
         }
         else
         {
             if (prevIsRec)
             {
-                outData.close();
-                if (chmod(nameBuf, S_IRUSR | S_IRGRP | S_IROTH))
-                {
-                    cerr << "Could net set file read-only";
-                }
+                closeFile();
             }
         }
 
-        prevIsRec = chunkAttrib.isRec;
+        prevIsRec = _attribs[i].isRec;
+    }
+}
 
-        if(shouldStop)
+
+void FileWriter::openIndex()
+{
+    unsigned char   header[sizeof(MAGIC_INDEX_STR) - 1 + sizeof(uint32_t)];
+    uint32_t        ver = INDEX_FILE_VERSION;
+    struct iovec    iov;
+
+    sprintf(indexNameBuf, "%s%s", nameBuf, INDEX_FILE_EXT);
+    indexFd = open(indexNameBuf, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (indexFd < 0)
+    {
+        cerr << "Error opening the file " << indexNameBuf << ", not writing the index" << endl;
+        return;
+    }
+
+    memcpy(header, MAGIC_INDEX_STR, strlen(MAGIC_INDEX_STR));             // string identifying the file type
+    memcpy(header + strlen(MAGIC_INDEX_STR), &ver, sizeof(uint32_t));     // version of file format
+    iov.iov_base = header;
+    iov.iov_len = sizeof(header);
+    if (!writeAll(indexFd, &iov, 1))
+    {
+        cerr << "Error writing the file " << indexNameBuf << ", not writing the index" << endl;
+        close(indexFd);
+        indexFd = -1;
+    }
+}
+
+
+void FileWriter::writeIndexEntries(IndexEntry* _entries, int _nEntries)
+{
+    struct iovec    iov;
+
+    iov.iov_base = _entries;
+    iov.iov_len = _nEntries * sizeof(IndexEntry);
+    if (!writeAll(indexFd, &iov, 1))
+    {
+        cerr << "Error writing the file " << indexNameBuf << ", not writing the rest of the index" << endl;
+        close(indexFd);
+        indexFd = -1;
+    }
+}
+
+
+void FileWriter::preallocate(uint64_t _len)
+{
+    if (!extentSize || _len <= allocatedLen)
+    {
+        return;
+    }
+
+    // Reserve whole extents ahead of the write head, so that the file is laid
+    // out contiguously. The file size is not changed.
+    while (allocatedLen < _len)
+    {
+        if (fallocate(outFd, FALLOC_FL_KEEP_SIZE, allocatedLen, extentSize))
         {
-            if(prevIsRec)
-            {
-                outData.close();
-                if (chmod(nameBuf, S_IRUSR | S_IRGRP | S_IROTH))
-                {
-                    cerr << "Could net set file read-only";
-                }
-            }
+            cerr << "Cannot preallocate " << nameBuf << " (" << strerror(errno) << "), preallocation disabled" << endl;
+            extentSize = 0;
             return;
         }
+        allocatedLen += extentSize;
+    }
+}
+
+
+void FileWriter::limitDirtyPages()
+{
+    // Data written with O_DIRECT does not go through the page cache
+    if (!dirtyWindow || directFile || fileOffset - syncedLen < dirtyWindow)
+    {
+        return;
+    }
+
+    // Start writing back the last window, wait for the window before it
+    // and drop it from the page cache. At most two windows of the file are
+    // dirty at any time.
+    if (sync_file_range(outFd, syncedLen, fileOffset - syncedLen, SYNC_FILE_RANGE_WRITE))
+    {
+        cerr << "Error flushing " << nameBuf << ": " << strerror(errno) << endl;
+    }
+    if (syncedLen > cleanLen)
+    {
+        if (sync_file_range(outFd, cleanLen, syncedLen - cleanLen,
+                            SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER))
+        {
+            cerr << "Error flushing " << nameBuf << ": " << strerror(errno) << endl;
+        }
+        posix_fadvise(outFd, cleanLen, syncedLen - cleanLen, POSIX_FADV_DONTNEED);
+        cleanLen = syncedLen;
+    }
+    syncedLen = fileOffset;
+}
+
+
+void FileWriter::closeFile()
+{
+    if (directFile)
+    {
+        if (!directFile->close())
+        {
+            cerr << "Error writing to the file " << nameBuf << ", the file is truncated at the failure" << endl;
+        }
+    }
+    else
+    {
+        // Give back the preallocated space past the end of the data, and
+        // cut off what a failed write may have left behind it
+        if ((allocatedLen > fileOffset || writeFailed) && ftruncate(outFd, fileOffset))
+        {
+            cerr << "Error truncating the file " << nameBuf << ": " << strerror(errno) << endl;
+        }
+        close(outFd);
+    }
+    if (chmod(nameBuf, S_IRUSR | S_IRGRP | S_IROTH))
+    {
+        cerr << "Could not set the file " << nameBuf << " read-only: " << strerror(errno) << endl;
     }
+
+    if (indexFd >= 0)
+    {
+        close(indexFd);
+        indexFd = -1;
+        if (chmod(indexNameBuf, S_IRUSR | S_IRGRP | S_IROTH))
+        {
+            cerr << "Could not set the file " << indexNameBuf << " read-only: " << strerror(errno) << endl;
+        }
+    }
+}
+
+
+void FileWriter::setPreRoll(int _preRoll)
+{
+    preRoll = _preRoll;
+}
+
+
+void FileWriter::setIoEngine(IoEngine* _ioEngine)
+{
+    ioEngine = _ioEngine;
+}
+
+
+void FileWriter::setDirectIo(bool _directIo)
+{
+    directIo = _directIo;
+}
+
+
+void FileWriter::setWriteback(uint64_t _extentSize, uint64_t _dirtyWindow)
+{
+    extentSize = _extentSize;
+    dirtyWindow = _dirtyWindow;
+}
+
+
+void FileWriter::setWriteIndex(bool _writeIndex)
+{
+    writeIndex = _writeIndex;
+}
+
+
+uint64_t FileWriter::getPreRollBytes()
+{
+    return(preRollBytes);
+}
+
+
+uint64_t FileWriter::getBytesWritten()
+{
+    return(bytesWritten);
+}
+
+
+uint64_t FileWriter::getWriteTime()
+{
+    return(writeTime);
 }
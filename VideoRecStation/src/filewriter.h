@@ -20,9 +20,14 @@
 #ifndef FILEWRITER_H_
 #define FILEWRITER_H_
 
+#include <atomic>
+#include <deque>
 #include <QString>
 #include "stoppablethread.h"
 #include "cycdatabuffer.h"
+#include "ioengine.h"
+#include "directfile.h"
+#include "common.h"
 
 //! Base class for audio/video stream writers
 /*!
@@ -39,6 +44,37 @@
  *
  * Derived classes should typically call init() inside the constructor and
  * cleanup() inside the destructor.
+ *
+ * With a pre-roll (see setPreRoll()) the writer does not release the chunks
+ * while not recording, but keeps the chunks of the last pre-roll
+ * milliseconds acquired in the buffer. When recording starts, these chunks
+ * are written to the file ahead of the first recorded chunk, directly from
+ * the buffer. The buffer should be large enough to hold the pre-roll; if it
+ * gets more than PRE_ROLL_MAX_LEVEL full, the oldest pre-roll chunks are
+ * released early.
+ *
+ * By default every writer writes its files itself. With an I/O engine (see
+ * setIoEngine()) the writes are done by the engine's thread instead, which
+ * submits the writes of all the writers sharing it together.
+ *
+ * With direct I/O (see setDirectIo()) the files are written with O_DIRECT
+ * through the staging buffers of a DirectFile, bypassing the page cache.
+ *
+ * Optionally (see setWriteback()) the files are preallocated in large
+ * extents, and the data behind a bounded window of dirty pages is written
+ * back and dropped from the page cache as the file grows.
+ *
+ * Optionally (see setWriteIndex()) every data file gets an index file
+ * (INDEX_FILE_EXT appended to its name) which is MAGIC_INDEX_STR,
+ * INDEX_FILE_VERSION (uint32) and an IndexEntry for every chunk. The index
+ * is appended after every batch written, once the batch has been handed to
+ * the file, so after a crash it only lacks the last batches.
+ *
+ * If writing a file fails, the rest of the recording is dropped, the file
+ * is cut back to the data written before the failure and the index is not
+ * extended any further. (With direct I/O the failure is only seen a batch or two later,
+ * so the index can point past the end of the data file; readers skip such
+ * entries.)
  */
 class FileWriter : public StoppableThread
 {
@@ -51,14 +87,115 @@ protected:
     virtual unsigned char* getHeader(int* _len) = 0;
 
 private:
+    //! Write a batch of chunks, opening and closing the files as the recording starts and stops.
+    void writeBatch(ChunkAttrib* _attribs, unsigned char** _chunks, int _nChunks);
+
+    //! Acquire a chunk while not recording; write out the pre-roll when recording starts.
+    void holdPreRoll();
+
+    //! Add an acquired chunk to the pre-roll, releasing the chunks that are too old.
+    void addPreRoll(const ChunkAttrib& _attrib, unsigned char* _data);
+
+    //! Release the pre-roll chunks more than the pre-roll older than _timestamp.
+    void trimPreRoll(uint64_t _timestamp);
+
+    //! Create the index file of the data file just opened and write its header.
+    void openIndex();
+
+    //! Preallocate the file in whole extents up to at least _len bytes.
+    void preallocate(uint64_t _len);
+
+    //! Write back and drop from the page cache what is behind the dirty window.
+    void limitDirtyPages();
+
+    void closeFile();
+
+    typedef struct
+    {
+        ChunkAttrib     attrib;
+        unsigned char*  data;
+    } PreRollChunk;
+
+    typedef struct
+    {
+        uint64_t        timestamp;
+        uint64_t        blockId;
+        uint64_t        offset;         // of the chunk's data in the data file
+        uint64_t        size;
+    } IndexEntry;
+
+    //! Append _nEntries entries to the index file.
+    void writeIndexEntries(IndexEntry* _entries, int _nEntries);
+
     CycDataBuffer*  cycBuf;
     char*           path;
     char*           suffix;
     char*           ext;
     int             streamId;
+    int             preRoll;        // in milliseconds
+    IoEngine*       ioEngine;
+    bool            directIo;
+    uint64_t        extentSize;     // in bytes, 0 for no preallocation
+    uint64_t        dirtyWindow;    // in bytes, 0 to leave flushing to the kernel
+    bool            writeIndex;
+
+    // Writer thread's state
+    bool            prevIsRec;
+    int             outFd;
+    uint64_t        fileOffset;     // bytes written to the current file
+    bool            writeFailed;    // the rest of the current recording is dropped
+    DirectFile*     directFile;     // only with direct I/O
+    uint64_t        allocatedLen;   // preallocated
+    uint64_t        syncedLen;      // writeback started
+    uint64_t        cleanLen;       // written back and dropped from the page cache
+    char            nameBuf[500];
+    int             indexFd;
+    char            indexNameBuf[500 + sizeof(INDEX_FILE_EXT)];
+    std::deque<PreRollChunk>    preRollChunks;     // acquired, oldest first
+
+    // Writer statistics, can be read from any thread
+    std::atomic<uint64_t>   bytesWritten;
+    std::atomic<uint64_t>   writeTime;      // in microseconds
+    std::atomic<uint64_t>   preRollBytes;   // buffer space held by the pre-roll
 
 public:
     QString readableFileName;
+
+    //! Total number of bytes written to the files so far.
+    uint64_t getBytesWritten();
+
+    //! Total time spent writing data to the files so far, in microseconds.
+    uint64_t getWriteTime();
+
+    /*!
+     * Keep the last _preRoll milliseconds of data while not recording and
+     * write them out when recording starts. Should be called before the
+     * thread is started.
+     */
+    void setPreRoll(int _preRoll);
+
+    /*!
+     * Do the file writes through _ioEngine, which can be shared with other
+     * writers. Should be called before the thread is started.
+     */
+    void setIoEngine(IoEngine* _ioEngine);
+
+    //! Write the files with O_DIRECT. Should be called before the thread is started.
+    void setDirectIo(bool _directIo);
+
+    /*!
+     * Preallocate the files in extents of _extentSize bytes and keep at most
+     * two windows of _dirtyWindow bytes of each file in the page cache. Zero
+     * disables the respective feature. Should be called before the thread is
+     * started.
+     */
+    void setWriteback(uint64_t _extentSize, uint64_t _dirtyWindow);
+
+    //! Write an index file for every data file. Should be called before the thread is started.
+    void setWriteIndex(bool _writeIndex);
+
+    //! Space in the buffer (in bytes) taken by the pre-roll. Can be called from any thread.
+    uint64_t getPreRollBytes();
 };
 
 #endif /* FILEWRITER_H_ */
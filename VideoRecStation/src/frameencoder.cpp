@@ -0,0 +1,195 @@
+/*
+ * frameencoder.cpp
+ *
+ * Author: Andrey Zhdanov
+ * Copyright (C) 2014 BioMag Laboratory, Helsinki University Central Hospital
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <atomic>
+
+#include "common.h"
+#include "frameencoder.h"
+#include "jpegencoder.h"
+#include "paralleljpegencoder.h"
+#include "losslessencoder.h"
+#include "turbojpegencoder.h"
+
+using namespace std;
+
+
+FrameEncoder::~FrameEncoder()
+{
+}
+
+
+int FrameEncoder::codecId(const QString& _backend)
+{
+    if (_backend == "libjpeg" || _backend == "turbojpeg")
+    {
+        return(VIDEO_CODEC_JPEG);
+    }
+    else if (_backend == "zstd")
+    {
+        return(VIDEO_CODEC_ZSTD);
+    }
+    else if (_backend == "lz4")
+    {
+        return(VIDEO_CODEC_LZ4);
+    }
+
+    return(-1);
+}
+
+
+bool FrameEncoder::isAvailable(const QString& _backend)
+{
+    switch (codecId(_backend))
+    {
+    case VIDEO_CODEC_JPEG:
+        // TurboJPEG falls back to libjpeg, which is always there
+        return(true);
+
+    case VIDEO_CODEC_ZSTD:
+#ifdef HAVE_ZSTD
+        return(true);
+#else
+        cerr << "zstd support is not compiled in" << endl;
+        return(false);
+#endif
+
+    case VIDEO_CODEC_LZ4:
+#ifdef HAVE_LZ4
+        return(true);
+#else
+        cerr << "LZ4 support is not compiled in" << endl;
+        return(false);
+#endif
+
+    default:
+        cerr << "Unknown video encoder backend " << _backend.toLocal8Bit().data()
+             << " (should be libjpeg, turbojpeg, zstd or lz4)" << endl;
+        return(false);
+    }
+}
+
+
+FrameEncoder* FrameEncoder::create(const QString& _backend, int _width, int _height, PixelFormat _format, int _quality, int _slices)
+{
+    // Lossless codecs (or unknown backends) never fall back to JPEG. The
+    // settings are checked with isAvailable() at startup, so this should not
+    // happen.
+    if (!isAvailable(_backend))
+    {
+        abort();
+    }
+
+    switch (codecId(_backend))
+    {
+#ifdef HAVE_ZSTD
+    case VIDEO_CODEC_ZSTD:
+        reportBackend("zstd (lossless)", false);
+        return(new LosslessEncoder(VIDEO_CODEC_ZSTD, _width, _height, _format, _quality, _slices));
+#endif
+
+#ifdef HAVE_LZ4
+    case VIDEO_CODEC_LZ4:
+        reportBackend("LZ4 (lossless)", false);
+        return(new LosslessEncoder(VIDEO_CODEC_LZ4, _width, _height, _format, _quality, _slices));
+#endif
+
+    default:
+        break;
+    }
+
+    if (_slices > 1)
+    {
+        ParallelJpegEncoder* encoder;
+
+        if (_backend != "libjpeg")
+        {
+            cerr << "Sliced encoding requires libjpeg backend, using libjpeg" << endl;
+        }
+
+        reportBackend("libjpeg", false);
+        encoder = new ParallelJpegEncoder(_width, _height, _format, _quality, _slices);
+        clog << "Encoding video frames in " << encoder->sliceCount() << " slices" << endl;
+        return(encoder);
+    }
+
+    if (_backend == "turbojpeg" && (_format == PIXEL_FORMAT_YUV422 || _format == PIXEL_FORMAT_YUV411))
+    {
+        cerr << "TurboJPEG backend does not support YUV input, using libjpeg" << endl;
+    }
+    else if (_backend == "turbojpeg")
+    {
+#ifdef HAVE_TURBOJPEG
+        TurboJpegEncoder* encoder = new TurboJpegEncoder(_width, _height, _format, _quality);
+        if (encoder->isValid())
+        {
+            reportBackend("TurboJPEG", true);
+            return(encoder);
+        }
+        delete encoder;
+        cerr << "Could not initialize TurboJPEG, falling back to libjpeg" << endl;
+#else
+        cerr << "TurboJPEG support is not compiled in, falling back to libjpeg" << endl;
+#endif
+    }
+
+    reportBackend("libjpeg", false);
+    return(new JpegEncoder(_width, _height, _format, _quality));
+}
+
+
+void FrameEncoder::reportBackend(const char* _name, bool _simd)
+{
+    static atomic<const char*> lastReported(NULL);
+
+    // The ring sizes are computed with a probe encoder, so the first report
+    // comes from there. Report again only if a different backend ends up
+    // being used, e.g. after a fallback.
+    if (lastReported.exchange(_name) == _name)
+    {
+        return;
+    }
+
+    clog << "Video encoder: " << _name;
+
+    // libjpeg-turbo selects its SIMD extensions at run time and does not
+    // tell which, so only report what the CPU supports and whether the
+    // selection is overridden through the JSIMD_* environment variables.
+#if defined(__x86_64__) || defined(__i386__)
+    if (_simd)
+    {
+        const char* forceNone = getenv("JSIMD_FORCENONE");
+        const char* forceSse2 = getenv("JSIMD_FORCESSE2");
+
+        clog << ", CPU supports: " << (__builtin_cpu_supports("avx2") ? "AVX2" : (__builtin_cpu_supports("sse2") ? "SSE2" : "no SIMD"));
+        if (forceNone && !strcmp(forceNone, "1"))
+        {
+            clog << " (SIMD disabled by JSIMD_FORCENONE)";
+        }
+        else if (forceSse2 && !strcmp(forceSse2, "1"))
+        {
+            clog << " (SIMD limited to SSE2 by JSIMD_FORCESSE2)";
+        }
+    }
+#endif
+
+    clog << endl;
+}
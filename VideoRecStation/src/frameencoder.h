@@ -0,0 +1,79 @@
+/*
+ * frameencoder.h
+ *
+ * Author: Andrey Zhdanov
+ * Copyright (C) 2014 BioMag Laboratory, Helsinki University Central Hospital
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAMEENCODER_H_
+#define FRAMEENCODER_H_
+
+#include <QString>
+#include "pixelformat.h"
+
+//! Base class for video frame compressors.
+/*!
+ * An encoder compresses frames of fixed size and pixel format. Encoders are
+ * not thread-safe; each thread should use its own encoder. Use create() to
+ * construct the encoder for the backend selected in the settings.
+ */
+class FrameEncoder
+{
+public:
+    virtual ~FrameEncoder();
+
+    //! Upper bound for the size of a compressed frame.
+    virtual int maxOutputSize() = 0;
+
+    //! Compress a single frame.
+    /*!
+     * _outBuf should have space for at least maxOutputSize() bytes. Return the
+     * size of the compressed frame.
+     */
+    virtual int encode(unsigned char* _image, unsigned char* _outBuf) = 0;
+
+    //! Change the quality (0..100) used for the subsequent frames.
+    virtual void setQuality(int _quality) = 0;
+
+    //! Create an encoder.
+    /*!
+     * _backend is one of the JPEG backends "libjpeg" or "turbojpeg" or one of
+     * the lossless codecs "zstd" or "lz4". If the requested JPEG backend is
+     * not available, fall back to libjpeg. Abort if _backend is unknown or
+     * its codec is not compiled in (see isAvailable()). If _slices is greater than 1,
+     * every frame is split into (up to) _slices horizontal slices compressed
+     * in parallel; for JPEG this is only supported by the libjpeg backend.
+     *
+     * For the lossless codecs _quality is the compression level (zstd) or
+     * the acceleration factor (LZ4).
+     */
+    static FrameEncoder* create(const QString& _backend, int _width, int _height, PixelFormat _format, int _quality, int _slices=1);
+
+    //! Return the codec tag (VIDEO_CODEC_*) of the frames produced by _backend, or -1 if the backend is unknown.
+    static int codecId(const QString& _backend);
+
+    /*!
+     * Return true if _backend is known and encoders for it can be created.
+     * Otherwise print the reason and return false. TurboJPEG is always
+     * available, as it falls back to libjpeg.
+     */
+    static bool isAvailable(const QString& _backend);
+
+private:
+    //! Print the name of the backend (and the SIMD extensions the CPU supports) whenever it changes.
+    static void reportBackend(const char* _name, bool _simd);
+};
+
+#endif /* FRAMEENCODER_H_ */
@@ -0,0 +1,300 @@
+/*
+ * ioengine.cpp
+ *
+ * Author: Andrey Zhdanov
+ * Copyright (C) 2014 BioMag Laboratory, Helsinki University Central Hospital
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <iostream>
+#include <algorithm>
+#include <QMutexLocker>
+
+#include "config.h"
+#include "ioengine.h"
+
+using namespace std;
+
+
+IoEngine::IoEngine()
+{
+    int res;
+
+    stopping = false;
+    uring = false;
+
+#ifdef HAVE_LIBURING
+    res = io_uring_queue_init(IO_ENGINE_QUEUE_DEPTH, &ring, 0);
+    if (res < 0)
+    {
+        cerr << "Could not set up io_uring (" << strerror(-res) << "), writing the files with pwritev" << endl;
+    }
+    else
+    {
+        uring = true;
+    }
+#else
+    (void)res;
+    cerr << "io_uring support is not compiled in, writing the files with pwritev" << endl;
+#endif
+
+    worker = new Worker(this);
+    worker->start();
+}
+
+
+IoEngine::~IoEngine()
+{
+    // Wake up the worker so that it notices it should stop. All the writers
+    // should have stopped by now.
+    stopping = true;
+    requestsQueued.release();
+    worker->stop();
+    delete worker;
+
+#ifdef HAVE_LIBURING
+    if (uring)
+    {
+        io_uring_queue_exit(&ring);
+    }
+#endif
+}
+
+
+bool IoEngine::write(int _fd, uint64_t _offset, struct iovec* _iov, int _iovCnt)
+{
+    Request req;
+
+    req.fd = _fd;
+    req.offset = _offset;
+    req.iov = _iov;
+    req.iovCnt = _iovCnt;
+    req.ok = true;
+
+    queueMutex.lock();
+    queue.push_back(&req);
+    queueMutex.unlock();
+    requestsQueued.release();
+
+    req.done.acquire();
+    return(req.ok);
+}
+
+
+bool IoEngine::isUring()
+{
+    return(uring);
+}
+
+
+void IoEngine::takeRequests(deque<Request*>* _requests, bool _wait)
+{
+    int n;
+
+    if (_wait)
+    {
+        requestsQueued.acquire();
+    }
+    else if (!requestsQueued.tryAcquire())
+    {
+        return;
+    }
+
+    // Take whatever else has been queued in the meantime
+    n = requestsQueued.available();
+    if (!requestsQueued.tryAcquire(n))
+    {
+        n = 0;
+    }
+    n++;
+
+    QMutexLocker locker(&queueMutex);
+    for (int i=0; i<n && !queue.empty(); i++)
+    {
+        _requests->push_back(queue.front());
+        queue.pop_front();
+    }
+}
+
+
+void IoEngine::runPwritev()
+{
+    deque<Request*> requests;
+    Request*        req;
+    ssize_t         res;
+
+    while (true)
+    {
+        takeRequests(&requests, true);
+        if (requests.empty() && stopping)
+        {
+            return;
+        }
+
+        while (!requests.empty())
+        {
+            req = requests.front();
+            requests.pop_front();
+
+            while (req->iovCnt > 0)
+            {
+                res = pwritev(req->fd, req->iov, min(req->iovCnt, IOV_MAX), req->offset);
+                if (res < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    cerr << "Error writing to the file: " << strerror(errno) << endl;
+                    req->ok = false;
+                    break;
+                }
+
+                // Nothing written although there is data left; retrying would loop forever
+                if (res == 0 && req->iov->iov_len > 0)
+                {
+                    cerr << "Error writing to the file: nothing written" << endl;
+                    req->ok = false;
+                    break;
+                }
+                advance(req, res);
+            }
+            req->done.release();
+        }
+    }
+}
+
+
+#ifdef HAVE_LIBURING
+void IoEngine::runUring()
+{
+    deque<Request*>         requests;
+    Request*                req;
+    struct io_uring_sqe*    sqe;
+    struct io_uring_cqe*    cqe;
+    unsigned int            head;
+    unsigned int            nReaped;
+    int                     inFlight = 0;
+
+    while (true)
+    {
+        // Only sleep on the queue if there is nothing else to do
+        takeRequests(&requests, inFlight == 0 && requests.empty());
+        if (requests.empty() && !inFlight && stopping)
+        {
+            return;
+        }
+
+        // Queue the writes; those not fitting in the submission queue are
+        // submitted after the next completions
+        while (!requests.empty() && (sqe = io_uring_get_sqe(&ring)))
+        {
+            req = requests.front();
+            requests.pop_front();
+            io_uring_prep_writev(sqe, req->fd, req->iov, min(req->iovCnt, IOV_MAX), req->offset);
+            io_uring_sqe_set_data(sqe, req);
+            inFlight++;
+        }
+
+        if (!inFlight)
+        {
+            continue;
+        }
+        io_uring_submit_and_wait(&ring, 1);
+
+        nReaped = 0;
+        io_uring_for_each_cqe(&ring, head, cqe)
+        {
+            req = (Request*)io_uring_cqe_get_data(cqe);
+            inFlight--;
+            nReaped++;
+
+            if (cqe->res < 0 && cqe->res != -EINTR && cqe->res != -EAGAIN)
+            {
+                cerr << "Error writing to the file: " << strerror(-cqe->res) << endl;
+                req->ok = false;
+                req->done.release();
+            }
+            else if (cqe->res == 0 && req->iovCnt > 0 && req->iov->iov_len > 0)
+            {
+                // Resubmitting would loop forever
+                cerr << "Error writing to the file: nothing written" << endl;
+                req->ok = false;
+                req->done.release();
+            }
+            else if (cqe->res >= 0 && advance(req, cqe->res))
+            {
+                req->done.release();
+            }
+            else
+            {
+                // Short or interrupted write, queue the rest again
+                requests.push_front(req);
+            }
+        }
+        io_uring_cq_advance(&ring, nReaped);
+    }
+}
+#endif
+
+
+bool IoEngine::advance(Request* _req, uint64_t _written)
+{
+    _req->offset += _written;
+
+    // Skip the buffers (or parts of them) that have been written
+    while (_req->iovCnt > 0 && _written >= _req->iov->iov_len)
+    {
+        _written -= _req->iov->iov_len;
+        _req->iov++;
+        _req->iovCnt--;
+    }
+    if (_req->iovCnt > 0)
+    {
+        _req->iov->iov_base = (char*)_req->iov->iov_base + _written;
+        _req->iov->iov_len -= _written;
+    }
+
+    return(_req->iovCnt == 0);
+}
+
+
+IoEngine::Worker::Worker(IoEngine* _engine)
+{
+    engine = _engine;
+}
+
+
+IoEngine::Worker::~Worker()
+{
+}
+
+
+void IoEngine::Worker::stoppableRun()
+{
+#ifdef HAVE_LIBURING
+    if (engine->uring)
+    {
+        engine->runUring();
+        return;
+    }
+#endif
+    engine->runPwritev();
+}
@@ -0,0 +1,113 @@
+/*
+ * ioengine.h
+ *
+ * Author: Andrey Zhdanov
+ * Copyright (C) 2014 BioMag Laboratory, Helsinki University Central Hospital
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef IOENGINE_H_
+#define IOENGINE_H_
+
+#include <stdint.h>
+#include <deque>
+#include <sys/uio.h>
+#include <QMutex>
+#include <QSemaphore>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#include "stoppablethread.h"
+
+//! Process-wide I/O thread doing the file writes of all the file writers.
+/*!
+ * File writers hand their batches of chunks to write(), which blocks until
+ * the batch is on its way to the disk. A single I/O thread collects the
+ * batches of all the writers and, if built with liburing, submits them to
+ * an io_uring together with a single system call, each batch as one
+ * vectored write at an explicit file offset (the writers track the offsets
+ * of their files themselves). Without io_uring support (or if the kernel
+ * does not provide it) the I/O thread writes the batches one after another
+ * with pwritev().
+ *
+ * Every writer has at most one batch in flight, so the batches of a file
+ * are always written in order.
+ */
+class IoEngine
+{
+public:
+    IoEngine();
+    virtual ~IoEngine();
+
+    /*!
+     * Write the _iovCnt buffers in _iov to _fd starting at _offset. The
+     * array _iov may be modified. Return false on error.
+     */
+    bool write(int _fd, uint64_t _offset, struct iovec* _iov, int _iovCnt);
+
+    //! Return true if io_uring is used.
+    bool isUring();
+
+private:
+    struct Request
+    {
+        int             fd;
+        uint64_t        offset;
+        struct iovec*   iov;
+        int             iovCnt;
+        bool            ok;
+        QSemaphore      done;
+    };
+
+    class Worker : public StoppableThread
+    {
+    public:
+        Worker(IoEngine* _engine);
+        virtual ~Worker();
+
+    protected:
+        virtual void stoppableRun();
+
+    private:
+        IoEngine*   engine;
+    };
+
+    //! Take the queued requests, waiting for at least one if _wait is true.
+    void takeRequests(std::deque<Request*>* _requests, bool _wait);
+
+    //! Write the requests one after another with pwritev().
+    void runPwritev();
+
+    //! Skip _written bytes of the request. Return true if all has been written.
+    static bool advance(Request* _req, uint64_t _written);
+
+#ifdef HAVE_LIBURING
+    //! Submit and complete the requests through io_uring.
+    void runUring();
+
+    struct io_uring     ring;
+#endif
+    bool                uring;
+
+    QMutex              queueMutex;
+    std::deque<Request*> queue;
+    QSemaphore          requestsQueued;
+    volatile bool       stopping;
+    Worker*             worker;
+};
+
+#endif /* IOENGINE_H_ */
@@ -0,0 +1,274 @@
+/*
+ * jpegencoder.cpp
+ *
+ * Author: Andrey Zhdanov
+ * Copyright (C) 2014 BioMag Laboratory, Helsinki University Central Hospital
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+
+#include "jpegencoder.h"
+
+using namespace std;
+
+// Upper bound for the size of a compressed frame. The JPEG can only get
+// larger than the raw image for noise-like images compressed with very high
+// quality.
+#define MAX_JPEG_SIZE(_rawSize) (2 * (_rawSize) + 65536)
+
+
+//---------------------------------------------------------------------
+// libjpeg destination manager writing the compressed image directly into
+// the buffer supplied by the caller
+//
+
+static void initDestination(j_compress_ptr _cinfo)
+{
+}
+
+
+static boolean emptyOutputBuffer(j_compress_ptr _cinfo)
+{
+    // Only called when the output buffer is exhausted
+    cerr << "Compressed frame does not fit into the output buffer!" << endl;
+    abort();
+}
+
+
+static void termDestination(j_compress_ptr _cinfo)
+{
+}
+
+
+JpegEncoder::JpegEncoder(int _width, int _height, PixelFormat _format, int _quality, int _restartRows)
+{
+    width = _width;
+    height = _height;
+    format = _format;
+    rowSize = rawRowSize(format, width);
+    maxSize = MAX_JPEG_SIZE(width * height * (format == PIXEL_FORMAT_MONO8 ? 1 : 3));
+    chromaFactor = 0;
+    planeBuf = NULL;
+
+    rowPointers = (JSAMPROW*)malloc(height * sizeof(JSAMPROW));
+    if (!rowPointers)
+    {
+        cerr << "Cannot allocate memory!" << endl;
+        abort();
+    }
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+
+    dest.init_destination = initDestination;
+    dest.empty_output_buffer = emptyOutputBuffer;
+    dest.term_destination = termDestination;
+    cinfo.dest = &dest;
+
+    // Set the parameters of the output file
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    switch (format)
+    {
+    case PIXEL_FORMAT_MONO8:
+        cinfo.input_components = 1;
+        cinfo.in_color_space = JCS_GRAYSCALE;
+        break;
+    case PIXEL_FORMAT_RGB8:
+        cinfo.input_components = 3;
+        cinfo.in_color_space = JCS_RGB;
+        break;
+    default:
+        cinfo.input_components = 3;
+        cinfo.in_color_space = JCS_YCbCr;
+        chromaFactor = (format == PIXEL_FORMAT_YUV422 ? 2 : 4);
+        break;
+    }
+
+    // Use default compression parameters. The quantization and Huffman tables
+    // built here are kept for the whole lifetime of the object.
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, _quality, TRUE);
+    cinfo.restart_in_rows = _restartRows;
+
+    if (chromaFactor)
+    {
+        if (width % (chromaFactor * DCTSIZE))
+        {
+            cerr << "Frame width " << width << " is not supported for YUV input" << endl;
+            abort();
+        }
+
+        // Match the camera's chroma subsampling and take the planes as they are
+        cinfo.raw_data_in = TRUE;
+#if JPEG_LIB_VERSION >= 70
+        cinfo.do_fancy_downsampling = FALSE;
+#endif
+        cinfo.comp_info[0].h_samp_factor = chromaFactor;
+        cinfo.comp_info[0].v_samp_factor = 1;
+        for (int i=1; i<3; i++)
+        {
+            cinfo.comp_info[i].h_samp_factor = 1;
+            cinfo.comp_info[i].v_samp_factor = 1;
+        }
+
+        planeBuf = (unsigned char*)malloc(DCTSIZE * (width + 2 * width / chromaFactor));
+        if (!planeBuf)
+        {
+            cerr << "Cannot allocate memory!" << endl;
+            abort();
+        }
+
+        for (int i=0; i<DCTSIZE; i++)
+        {
+            planeRows[0][i] = planeBuf + i * width;
+            planeRows[1][i] = planeBuf + DCTSIZE * width + i * (width / chromaFactor);
+            planeRows[2][i] = planeBuf + DCTSIZE * (width + width / chromaFactor) + i * (width / chromaFactor);
+        }
+        for (int i=0; i<3; i++)
+        {
+            planes[i] = planeRows[i];
+        }
+    }
+}
+
+
+JpegEncoder::~JpegEncoder()
+{
+    jpeg_destroy_compress(&cinfo);
+    free(rowPointers);
+    free(planeBuf);
+}
+
+
+int JpegEncoder::mcuHeight()
+{
+    int maxVSampFactor = 1;
+
+    // Single-component scans are not interleaved and use one block per MCU
+    if (cinfo.num_components == 1)
+    {
+        return(DCTSIZE);
+    }
+
+    for (int i=0; i<cinfo.num_components; i++)
+    {
+        if (cinfo.comp_info[i].v_samp_factor > maxVSampFactor)
+        {
+            maxVSampFactor = cinfo.comp_info[i].v_samp_factor;
+        }
+    }
+
+    return(maxVSampFactor * DCTSIZE);
+}
+
+
+void JpegEncoder::setQuality(int _quality)
+{
+    // Rebuilds the quantization tables; the Huffman tables do not depend on
+    // the quality.
+    jpeg_set_quality(&cinfo, _quality, TRUE);
+}
+
+
+int JpegEncoder::maxOutputSize()
+{
+    return(maxSize);
+}
+
+
+void JpegEncoder::deinterleaveStrip(unsigned char* _image, int _firstRow)
+{
+    unsigned char*  src;
+    unsigned char*  y;
+    unsigned char*  cb;
+    unsigned char*  cr;
+
+    for (int i=0; i<DCTSIZE; i++)
+    {
+        // Rows past the bottom of the image replicate the last one
+        src = _image + min(_firstRow + i, height - 1) * rowSize;
+        y = planeRows[0][i];
+        cb = planeRows[1][i];
+        cr = planeRows[2][i];
+
+        if (chromaFactor == 2)
+        {
+            // U Y V Y
+            for (int j=0; j<width/2; j++)
+            {
+                *(cb++) = src[0];
+                *(y++) = src[1];
+                *(cr++) = src[2];
+                *(y++) = src[3];
+                src += 4;
+            }
+        }
+        else
+        {
+            // U Y Y V Y Y
+            for (int j=0; j<width/4; j++)
+            {
+                *(cb++) = src[0];
+                *(y++) = src[1];
+                *(y++) = src[2];
+                *(cr++) = src[3];
+                *(y++) = src[4];
+                *(y++) = src[5];
+                src += 6;
+            }
+        }
+    }
+}
+
+
+int JpegEncoder::encode(unsigned char* _image, unsigned char* _outBuf)
+{
+    dest.next_output_byte = _outBuf;
+    dest.free_in_buffer = maxSize;
+
+    // Write all the tables, so that every frame is a complete JPEG image
+    jpeg_start_compress(&cinfo, TRUE);
+
+    if (chromaFactor)
+    {
+        // Raw planes are fed one iMCU row (DCTSIZE rows, as v_samp_factor
+        // is 1) at a time
+        while(cinfo.next_scanline < cinfo.image_height)
+        {
+            deinterleaveStrip(_image, cinfo.next_scanline);
+            jpeg_write_raw_data(&cinfo, planes, DCTSIZE);
+        }
+    }
+    else
+    {
+        for (int i=0; i<height; i++)
+        {
+            rowPointers[i] = _image + i * rowSize;
+        }
+
+        // Feed as many rows as libjpeg is willing to take at once
+        while(cinfo.next_scanline < cinfo.image_height)
+        {
+            jpeg_write_scanlines(&cinfo, rowPointers + cinfo.next_scanline, cinfo.image_height - cinfo.next_scanline);
+        }
+    }
+
+    jpeg_finish_compress(&cinfo);
+
+    return(maxSize - dest.free_in_buffer);
+}
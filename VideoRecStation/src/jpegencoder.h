@@ -0,0 +1,78 @@
+/*
+ * jpegencoder.h
+ *
+ * Author: Andrey Zhdanov
+ * Copyright (C) 2014 BioMag Laboratory, Helsinki University Central Hospital
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JPEGENCODER_H_
+#define JPEGENCODER_H_
+
+#include <stdio.h>
+#include <jpeglib.h>
+
+#include "frameencoder.h"
+
+//! Long-lived libjpeg compressor for frames of fixed size and pixel format.
+/*!
+ * The libjpeg compression object, the compression parameters (including
+ * quantization and Huffman tables) and the destination manager are set up
+ * once in the constructor and reused for every frame.
+ *
+ * YUV frames are fed to libjpeg as raw downsampled planes
+ * (jpeg_write_raw_data) with the chroma subsampling of the camera (2x1 for
+ * YUV422, 4x1 for YUV411), so no colour conversion or downsampling is done
+ * by libjpeg. The frame width should be a multiple of 16 (YUV422) or 32
+ * (YUV411) pixels.
+ *
+ * If _restartRows is not 0, a restart marker is inserted after every
+ * _restartRows rows of MCUs.
+ */
+class JpegEncoder : public FrameEncoder
+{
+public:
+    JpegEncoder(int _width, int _height, PixelFormat _format, int _quality, int _restartRows=0);
+    virtual ~JpegEncoder();
+
+    //! Height of a row of MCUs in pixels.
+    int mcuHeight();
+
+    virtual int maxOutputSize();
+    virtual int encode(unsigned char* _image, unsigned char* _outBuf);
+    virtual void setQuality(int _quality);
+
+private:
+    //! Split DCTSIZE rows starting at _firstRow into the raw planes.
+    void deinterleaveStrip(unsigned char* _image, int _firstRow);
+
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr       jerr;
+    struct jpeg_destination_mgr dest;
+
+    int             width;
+    int             height;
+    PixelFormat     format;
+    int             rowSize;        // in bytes
+    int             maxSize;
+    JSAMPROW*       rowPointers;
+
+    // Raw planes of a strip of DCTSIZE rows (YUV formats only)
+    int             chromaFactor;   // horizontal chroma subsampling
+    unsigned char*  planeBuf;
+    JSAMPROW        planeRows[3][DCTSIZE];
+    JSAMPARRAY      planes[3];
+};
+
+#endif /* JPEGENCODER_H_ */
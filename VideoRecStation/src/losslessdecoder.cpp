@@ -0,0 +1,160 @@
+/*
+ * losslessdecoder.cpp
+ *
+ * Author: Andrey Zhdanov
+ * Copyright (C) 2014 BioMag Laboratory, Helsinki University Central Hospital
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <iostream>
+#include <algorithm>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#include "common.h"
+#include "losslessdecoder.h"
+
+using namespace std;
+
+
+LosslessDecoder::LosslessDecoder(int _codec)
+{
+    codec = _codec;
+    frameBuf = NULL;
+    frameBufSize = 0;
+}
+
+
+LosslessDecoder::~LosslessDecoder()
+{
+    free(frameBuf);
+}
+
+
+unsigned char* LosslessDecoder::decode(unsigned char* _data, int _size, int* _width, int* _height, PixelFormat* _format)
+{
+    uint16_t        width;
+    uint16_t        height;
+    uint16_t        nBands;
+    uint32_t        bandSize;
+    int             rowSize;
+    int             rowsPerBand;
+    int             headerSize;
+    uint64_t        frameSize;
+    unsigned char*  src;
+    unsigned char*  dst;
+
+    if (_size < 8)
+    {
+        return(NULL);
+    }
+
+    memcpy(&width, _data, sizeof(uint16_t));
+    memcpy(&height, _data + 2, sizeof(uint16_t));
+    memcpy(&nBands, _data + 6, sizeof(uint16_t));
+    if (_data[4] > PIXEL_FORMAT_YUV411 || _data[5] != LOSSLESS_FILTER_UP || nBands == 0)
+    {
+        return(NULL);
+    }
+
+    // The frame may have been overwritten while being read, so the header
+    // cannot be trusted to be sane
+    if (width != VIDEO_WIDTH || height != VIDEO_HEIGHT || nBands > height)
+    {
+        return(NULL);
+    }
+
+    *_width = width;
+    *_height = height;
+    *_format = PixelFormat(_data[4]);
+    rowSize = rawRowSize(*_format, width);
+    rowsPerBand = (height + nBands - 1) / nBands;
+    headerSize = 8 + nBands * sizeof(uint32_t);
+    if (_size < headerSize)
+    {
+        return(NULL);
+    }
+
+    frameSize = uint64_t(height) * rowSize;
+    if (uint64_t(frameBufSize) < frameSize)
+    {
+        free(frameBuf);
+        frameBuf = (unsigned char*)malloc(frameSize);
+        if (!frameBuf)
+        {
+            cerr << "Cannot allocate memory!" << endl;
+            frameBufSize = 0;
+            return(NULL);
+        }
+        frameBufSize = frameSize;
+    }
+
+    src = _data + headerSize;
+    for (int i=0; i<nBands; i++)
+    {
+        int firstRow = i * rowsPerBand;
+        int nRows = min(rowsPerBand, height - firstRow);
+        int rawSize = -1;
+
+        memcpy(&bandSize, _data + 8 + i * sizeof(uint32_t), sizeof(uint32_t));
+        if (nRows <= 0 || bandSize > uint64_t(_data + _size - src))
+        {
+            return(NULL);
+        }
+
+        dst = frameBuf + firstRow * rowSize;
+        switch (codec)
+        {
+#ifdef HAVE_ZSTD
+        case VIDEO_CODEC_ZSTD:
+        {
+            size_t res = ZSTD_decompress(dst, nRows * rowSize, src, bandSize);
+            rawSize = (ZSTD_isError(res) ? -1 : int(res));
+            break;
+        }
+#endif
+#ifdef HAVE_LZ4
+        case VIDEO_CODEC_LZ4:
+            rawSize = LZ4_decompress_safe((const char*)src, (char*)dst, bandSize, nRows * rowSize);
+            break;
+#endif
+        default:
+            return(NULL);
+        }
+
+        if (rawSize != nRows * rowSize)
+        {
+            return(NULL);
+        }
+
+        // Undo the up filter
+        for (int j=rowSize; j<nRows*rowSize; j++)
+        {
+            dst[j] += dst[j - rowSize];
+        }
+
+        src += bandSize;
+    }
+
+    return(frameBuf);
+}
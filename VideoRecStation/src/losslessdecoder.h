@@ -0,0 +1,50 @@
+/*
+ * losslessdecoder.h
+ *
+ * Author: Andrey Zhdanov
+ * Copyright (C) 2014 BioMag Laboratory, Helsinki University Central Hospital
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LOSSLESSDECODER_H_
+#define LOSSLESSDECODER_H_
+
+#include "pixelformat.h"
+
+//! Decompressor for the frames produced by LosslessEncoder.
+/*!
+ * Used for showing the live video when recording lossless video. The
+ * decompressed frame is kept in a buffer owned by the decoder.
+ */
+class LosslessDecoder
+{
+public:
+    LosslessDecoder(int _codec);
+    virtual ~LosslessDecoder();
+
+    //! Decompress a frame.
+    /*!
+     * Return the raw frame, which stays valid until the next call, or NULL if
+     * the frame is corrupted or the codec is not supported.
+     */
+    unsigned char* decode(unsigned char* _data, int _size, int* _width, int* _height, PixelFormat* _format);
+
+private:
+    int             codec;
+    unsigned char*  frameBuf;
+    int             frameBufSize;
+};
+
+#endif /* LOSSLESSDECODER_H_ */
@@ -0,0 +1,220 @@
+/*
+ * losslessencoder.cpp
+ *
+ * Author: Andrey Zhdanov
+ * Copyright (C) 2014 BioMag Laboratory, Helsinki University Central Hospital
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#if defined(HAVE_ZSTD) || defined(HAVE_LZ4)
+
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <algorithm>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#include "common.h"
+#include "losslessencoder.h"
+
+using namespace std;
+
+
+LosslessEncoder::LosslessEncoder(int _codec, int _width, int _height, PixelFormat _format, int _level, int _nBands)
+{
+    int rowsPerBand;
+
+    codec = _codec;
+    width = _width;
+    height = _height;
+    format = _format;
+    rowSize = rawRowSize(format, width);
+    level = _level;
+    curImage = NULL;
+
+    if (_nBands < 1)
+    {
+        _nBands = 1;
+    }
+    rowsPerBand = (height + _nBands - 1) / _nBands;
+
+    maxSize = 0;
+    for (int firstRow = 0; firstRow < height; firstRow += rowsPerBand)
+    {
+        Band band;
+
+        band.firstRow = firstRow;
+        band.nRows = min(rowsPerBand, height - firstRow);
+        band.compressedSize = 0;
+#ifdef HAVE_ZSTD
+        band.zstdCtx = NULL;
+#endif
+
+        switch (codec)
+        {
+#ifdef HAVE_ZSTD
+        case VIDEO_CODEC_ZSTD:
+            band.maxCompressedSize = ZSTD_compressBound(band.nRows * rowSize);
+            band.zstdCtx = ZSTD_createCCtx();
+            if (!band.zstdCtx)
+            {
+                cerr << "Cannot create zstd compression context" << endl;
+                abort();
+            }
+            break;
+#endif
+#ifdef HAVE_LZ4
+        case VIDEO_CODEC_LZ4:
+            band.maxCompressedSize = LZ4_compressBound(band.nRows * rowSize);
+            break;
+#endif
+        default:
+            cerr << "Lossless codec " << codec << " is not supported" << endl;
+            abort();
+        }
+
+        band.filtered = (unsigned char*)malloc(band.nRows * rowSize);
+        band.compressed = (unsigned char*)malloc(band.maxCompressedSize);
+        if (!band.filtered || !band.compressed)
+        {
+            cerr << "Cannot allocate memory!" << endl;
+            abort();
+        }
+
+        maxSize += band.maxCompressedSize;
+        bands.push_back(band);
+    }
+
+    headerSize = 3 * sizeof(uint16_t) + 2 * sizeof(uint8_t) + bands.size() * sizeof(uint32_t);
+    maxSize += headerSize;
+
+    runner = new SliceRunner(this, bands.size());
+}
+
+
+LosslessEncoder::~LosslessEncoder()
+{
+    delete runner;
+
+    for (unsigned int i=0; i<bands.size(); i++)
+    {
+#ifdef HAVE_ZSTD
+        ZSTD_freeCCtx(bands[i].zstdCtx);
+#endif
+        free(bands[i].filtered);
+        free(bands[i].compressed);
+    }
+}
+
+
+int LosslessEncoder::maxOutputSize()
+{
+    return(maxSize);
+}
+
+
+void LosslessEncoder::setQuality(int _quality)
+{
+}
+
+
+void LosslessEncoder::processSlice(int _idx)
+{
+    Band&           band = bands[_idx];
+    unsigned char*  src = curImage + band.firstRow * rowSize;
+
+    // Up filter: every row but the first is stored as the difference from
+    // the row above
+    memcpy(band.filtered, src, rowSize);
+    for (int i=1; i<band.nRows; i++)
+    {
+        unsigned char*  cur = src + i * rowSize;
+        unsigned char*  prev = cur - rowSize;
+        unsigned char*  dst = band.filtered + i * rowSize;
+
+        for (int j=0; j<rowSize; j++)
+        {
+            dst[j] = cur[j] - prev[j];
+        }
+    }
+
+#ifdef HAVE_ZSTD
+    if (codec == VIDEO_CODEC_ZSTD)
+    {
+        size_t res = ZSTD_compressCCtx(band.zstdCtx, band.compressed, band.maxCompressedSize,
+                                       band.filtered, band.nRows * rowSize, level);
+        if (ZSTD_isError(res))
+        {
+            cerr << "zstd compression failed: " << ZSTD_getErrorName(res) << endl;
+            abort();
+        }
+        band.compressedSize = res;
+        return;
+    }
+#endif
+
+#ifdef HAVE_LZ4
+    band.compressedSize = LZ4_compress_fast((const char*)band.filtered, (char*)band.compressed,
+                                            band.nRows * rowSize, band.maxCompressedSize, level);
+    if (band.compressedSize <= 0)
+    {
+        cerr << "LZ4 compression failed" << endl;
+        abort();
+    }
+#endif
+}
+
+
+int LosslessEncoder::encode(unsigned char* _image, unsigned char* _outBuf)
+{
+    uint16_t        dim;
+    uint32_t        bandSize;
+    unsigned char*  ptr = _outBuf;
+
+    curImage = _image;
+    runner->run();
+
+    dim = width;
+    memcpy(ptr, &dim, sizeof(uint16_t));
+    ptr += sizeof(uint16_t);
+    dim = height;
+    memcpy(ptr, &dim, sizeof(uint16_t));
+    ptr += sizeof(uint16_t);
+    *(ptr++) = format;
+    *(ptr++) = LOSSLESS_FILTER_UP;
+    dim = bands.size();
+    memcpy(ptr, &dim, sizeof(uint16_t));
+    ptr += sizeof(uint16_t);
+
+    for (unsigned int i=0; i<bands.size(); i++)
+    {
+        bandSize = bands[i].compressedSize;
+        memcpy(ptr, &bandSize, sizeof(uint32_t));
+        ptr += sizeof(uint32_t);
+    }
+
+    for (unsigned int i=0; i<bands.size(); i++)
+    {
+        memcpy(ptr, bands[i].compressed, bands[i].compressedSize);
+        ptr += bands[i].compressedSize;
+    }
+
+    return(ptr - _outBuf);
+}
+
+#endif /* HAVE_ZSTD || HAVE_LZ4 */
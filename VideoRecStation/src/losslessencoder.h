@@ -0,0 +1,100 @@
+/*
+ * losslessencoder.h
+ *
+ * Author: Andrey Zhdanov
+ * Copyright (C) 2014 BioMag Laboratory, Helsinki University Central Hospital
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LOSSLESSENCODER_H_
+#define LOSSLESSENCODER_H_
+
+#if defined(HAVE_ZSTD) || defined(HAVE_LZ4)
+
+#include <vector>
+#include <stdint.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "frameencoder.h"
+#include "slicerunner.h"
+
+//! Lossless frame compressor using zstd or LZ4.
+/*!
+ * The frame is split into horizontal bands that are compressed in parallel.
+ * Before compression every row of a band except the first one is replaced
+ * by its bytewise difference (modulo 256) from the previous row, which makes
+ * camera images considerably more compressible.
+ *
+ * Compressed frame layout (all the numbers are little-endian):
+ *
+ *      uint16  width (in pixels)
+ *      uint16  height
+ *      uint8   pixel format (PixelFormat)
+ *      uint8   row filter (LOSSLESS_FILTER_UP)
+ *      uint16  number of bands
+ *      uint32  compressed size of every band
+ *      ...     compressed bands
+ *
+ * All the bands except the last one have ceil(height / number of bands)
+ * rows. _level is the zstd compression level or the LZ4 acceleration
+ * factor.
+ */
+class LosslessEncoder : public FrameEncoder, private SliceJob
+{
+public:
+    LosslessEncoder(int _codec, int _width, int _height, PixelFormat _format, int _level, int _nBands);
+    virtual ~LosslessEncoder();
+
+    virtual int maxOutputSize();
+    virtual int encode(unsigned char* _image, unsigned char* _outBuf);
+
+    //! Quality does not apply to lossless compression; ignored.
+    virtual void setQuality(int _quality);
+
+private:
+    struct Band
+    {
+        int             firstRow;
+        int             nRows;
+        unsigned char*  filtered;
+        unsigned char*  compressed;
+        int             maxCompressedSize;
+        int             compressedSize;
+#ifdef HAVE_ZSTD
+        ZSTD_CCtx*      zstdCtx;
+#endif
+    };
+
+    virtual void processSlice(int _idx);
+
+    std::vector<Band>   bands;
+    SliceRunner*        runner;
+    int                 codec;
+    int                 width;
+    int                 height;
+    PixelFormat         format;
+    int                 rowSize;        // in bytes
+    int                 level;
+    int                 headerSize;
+    int                 maxSize;
+    unsigned char*      curImage;
+};
+
+#endif /* HAVE_ZSTD || HAVE_LZ4 */
+
+#endif /* LOSSLESSENCODER_H_ */
@@ -19,8 +19,10 @@
 
 
 #include <iostream>
+#include <unistd.h>
 #include <sys/statvfs.h>
 #include <math.h>
+#include <algorithm>
 
 #include <QStorageInfo>
 
@@ -34,6 +36,11 @@ MainDialog::MainDialog(QWidget *parent)
     : QMainWindow(parent)
 {
     Qt::WindowFlags flags = Qt::WindowTitleHint;
+    uint64_t        arenaSize;
+    uint64_t        rawBufSize;
+    uint64_t        compressedBufSize;
+    uint64_t        audioBufSize;
+    int             audioPeriodSize;
 
     if (settings.controlOnTop)
     {
@@ -58,13 +65,55 @@ MainDialog::MainDialog(QWidget *parent)
     ui.clipLabel->setVisible(false);
 
     // Set up video recording
+    if (settings.compressorThreads > 0)
+    {
+        compressorPool = new CompressorPool(settings.compressorThreads, settings.encoderBackend);
+    }
+    else
+    {
+        compressorPool = NULL;
+    }
+    recordingEpoch = new RecordingEpoch();
+    if (settings.sharedIoEngine)
+    {
+        ioEngine = new IoEngine();
+    }
+    else
+    {
+        ioEngine = NULL;
+    }
     initVideo();
 
+    // Set up the memory for the circular buffers. Cameras switched off give
+    // their buffers back to the arena for the cameras switched on next.
+    audioPeriodSize = settings.framesPerPeriod * N_CHANS * sizeof(AUDIO_DATA_TYPE);
+    audioBufSize = BufferArena::ringSize(double(settings.sampRate) * N_CHANS * sizeof(AUDIO_DATA_TYPE), audioPeriodSize,
+                                         settings.bufferLatency + settings.preRoll / PRE_ROLL_MAX_LEVEL);
+    arenaSize = settings.arenaSize;
+    if (!arenaSize)
+    {
+        VideoDialog::ringSizes(settings, settings.zeroCopyCapture && !settings.dummyMode, &rawBufSize, &compressedBufSize);
+        arenaSize = numCameras * (rawBufSize + compressedBufSize) + audioBufSize;
+
+        // Leave room for rounding the buffers up to the arena's granularity
+        arenaSize += (2 * numCameras + 1) * (settings.bufferHugePages ? HUGE_PAGE_SIZE : sysconf(_SC_PAGESIZE));
+    }
+    bufferArena = new BufferArena(arenaSize, settings.bufferHugePages, settings.lockBuffers);
+
     // Set up audio recording
-    cycAudioBuf = new CycDataBuffer(CIRC_AUDIO_BUFF_SZ);
+    cycAudioBuf = new CycDataBuffer(bufferArena, audioBufSize);
+    cycAudioBuf->setRecordingEpoch(recordingEpoch);
+    cycAudioBuf->setOverflowPolicy(settings.overflowPolicy, "audio", settings.overflowTimeout, settings.overflowSpillPath.toLocal8Bit().data());
     microphoneThread = new MicrophoneThread(cycAudioBuf);
     audioFileWriter = new AudioFileWriter(cycAudioBuf, settings.storagePath.toLocal8Bit().data());
-    QObject::connect(cycAudioBuf, SIGNAL(chunkReady(unsigned char*)), this, SLOT(onAudioUpdate(unsigned char*)));
+    audioFileWriter->setPreRoll(settings.preRoll * 1000);
+    audioFileWriter->setIoEngine(ioEngine);
+    audioFileWriter->setDirectIo(settings.directIo);
+    audioFileWriter->setWriteback(uint64_t(settings.fileExtentSize) << 20, uint64_t(settings.dirtyWindow) << 20);
+    audioFileWriter->setWriteIndex(settings.writeIndex);
+    QObject::connect(cycAudioBuf, SIGNAL(chunkReady(unsigned char*)), this, SLOT(onAudioUpdate()));
+    memset(&audioCursor, 0, sizeof(audioCursor));
+    audioPeriod = new AUDIO_DATA_TYPE[settings.framesPerPeriod * N_CHANS];
 
     // Initialize volume indicator history
     memset(volMaxvals, 0, N_CHANS * N_BUF_4_VOL_IND * sizeof(AUDIO_DATA_TYPE));
@@ -138,6 +187,16 @@ void MainDialog::updateDiskSpace()
 MainDialog::~MainDialog()
 {
     // TODO: Implement proper destructor
+    clog << audioCursor.missed << " audio periods not shown or played back" << endl;
+    if (speakerBuffer)
+    {
+        clog << "Speaker feedback: " << speakerBuffer->overruns() << " period(s) discarded, "
+             << speakerBuffer->underruns() << " period(s) of silence inserted, peak occupancy "
+             << speakerBuffer->stats().peakOccupancy << " period(s), latency median "
+             << speakerBuffer->latency().percentile(50) << " us, max " << speakerBuffer->latency().max() << " us" << endl;
+    }
+    delete compressorPool;
+    delete[] audioPeriod;
     delete statusLeft;
     delete statusRight;
     delete updateTimer;
@@ -165,12 +224,10 @@ void MainDialog::onStartRec()
     for (unsigned int i=0; i<numCameras; i++)
     {
         camCheckBoxes[i]->setEnabled(false);
-        if (camCheckBoxes[i]->isChecked())
-        {
-            videoDialogs[i]->setIsRec(true);
-        }
     }
-    cycAudioBuf->setIsRec(true);
+
+    // All the streams start recording with the chunks captured from now on
+    recordingEpoch->start(RecordingEpoch::now());
     updateElapsed->start();
     updateTimer->start();
 }
@@ -183,6 +240,7 @@ void MainDialog::onStopRec()
                              "Are you sure you want to stop recording?",
                              QMessageBox::Ok | QMessageBox::Cancel, QMessageBox::Cancel) != QMessageBox::Ok)
         return;
+    recordingEpoch->stop(RecordingEpoch::now());
     updateTimer->stop();
     ui.stopButton->setEnabled(false);
     ui.startButton->setEnabled(true);
@@ -191,13 +249,8 @@ void MainDialog::onStopRec()
     for (unsigned int i=0; i<numCameras; i++)
     {
         camCheckBoxes[i]->setEnabled(cameras[i] != NULL || settings.dummyMode);
-        if(camCheckBoxes[i]->checkState() == Qt::Checked)
-        {
-            videoDialogs[i]->setIsRec(false);
-        }
     }
 
-    cycAudioBuf->setIsRec(false);
     QString fileName = QString(audioFileWriter->readableFileName);
     fileName.chop(13);
     statusLeft->setText(QString("Saved %1...").arg(fileName));
@@ -206,7 +259,7 @@ void MainDialog::onStopRec()
 
 void MainDialog::setupVideoDialog(unsigned int idx)
 {
-    videoDialogs[idx] = new VideoDialog(cameras[idx], idx);
+    videoDialogs[idx] = new VideoDialog(cameras[idx], idx, recordingEpoch, compressorPool, bufferArena, ioEngine);
     if(settings.videoRects[idx].isValid())
         videoDialogs[idx]->setGeometry(settings.videoRects[idx]);
     videoDialogs[idx]->findChild<QSlider*>("shutterSlider")->setValue(settings.videoShutters[idx]);
@@ -241,7 +294,25 @@ void MainDialog::onExit()
 }
 
 
-void MainDialog::onAudioUpdate(unsigned char* _data)
+void MainDialog::onAudioUpdate()
+{
+    ChunkAttrib     chunkAttrib;
+    unsigned char*  data;
+
+    // Process every period that has not been overwritten yet. Copy the data
+    // first, so that it cannot change after it has been validated.
+    while((data = cycAudioBuf->readChunk(&audioCursor, &chunkAttrib)))
+    {
+        memcpy(audioPeriod, data, min(chunkAttrib.chunkSize, int(settings.framesPerPeriod * N_CHANS * sizeof(AUDIO_DATA_TYPE))));
+        if (cycAudioBuf->chunkIntact(&audioCursor))
+        {
+            processAudioPeriod();
+        }
+    }
+}
+
+
+void MainDialog::processAudioPeriod()
 {
     unsigned int    i=0;
     unsigned int    j;
@@ -254,7 +325,7 @@ void MainDialog::onAudioUpdate(unsigned char* _data)
     {
         for(j=0; j<N_CHANS; j++)
         {
-            curval = abs(((AUDIO_DATA_TYPE*)_data)[i++]);
+            curval = abs(audioPeriod[i++]);
             volMaxvals[volIndNext + j] = (volMaxvals[volIndNext + j] >= curval) ? volMaxvals[volIndNext + j] : curval;
         }
     }
@@ -292,7 +363,7 @@ void MainDialog::onAudioUpdate(unsigned char* _data)
     // Feed to the speaker
     if(speakerBuffer)
     {
-        speakerBuffer->insertChunk(_data);
+        speakerBuffer->insertChunk(audioPeriod);
     }
 }
 
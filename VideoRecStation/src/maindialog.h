@@ -36,6 +36,10 @@
 #include "speakerthread.h"
 #include "videocompressorthread.h"
 #include "videodialog.h"
+#include "compressorpool.h"
+#include "bufferarena.h"
+#include "ioengine.h"
+#include "recordingepoch.h"
 #include "settings.h"
 
 
@@ -52,7 +56,7 @@ public slots:
     void onStartRec();
     void onStopRec();
     void onExit();
-    void onAudioUpdate(unsigned char* _data);
+    void onAudioUpdate();
     void onCamToggled(bool _state);
     void updateDiskSpace();
     void updateRunningStatus();
@@ -63,17 +67,26 @@ private:
     void setupVideoDialog(unsigned int);
     void cleanVideoDialog(unsigned int);
 
+    //! Update the volume indicator and feed the speaker with the period in audioPeriod.
+    void processAudioPeriod();
+
     Ui::MainDialogClass ui;
 
     dc1394camera_t*     cameras[MAX_CAMERAS];
     VideoDialog*        videoDialogs[MAX_CAMERAS];
     QCheckBox*          camCheckBoxes[MAX_CAMERAS];
     unsigned int        numCameras;
+    CompressorPool*     compressorPool;
+    BufferArena*        bufferArena;        // memory of all the circular buffers
+    RecordingEpoch*     recordingEpoch;     // shared by all the recorded streams
+    IoEngine*           ioEngine;           // shared by all the file writers, can be NULL
     QSpacerItem*        vertSpacer;
 
     MicrophoneThread*   microphoneThread;
     CycDataBuffer*      cycAudioBuf;
     AudioFileWriter*    audioFileWriter;
+    ChunkCursor         audioCursor;
+    AUDIO_DATA_TYPE*    audioPeriod;        // copy of the period being processed
 
     QLabel *statusLeft;
     QLabel *statusRight;
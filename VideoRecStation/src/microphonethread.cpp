@@ -133,6 +133,8 @@ void MicrophoneThread::stoppableRun()
         cerr << "Cannot set microphone thread priority. Continuing nevertheless, but don't blame me if you experience any strange problems." << endl;
     }
 
+    chunkAttrib.blockId = 0;
+
     // Start the acquisition loop
     while(true)
     {
@@ -159,6 +161,7 @@ void MicrophoneThread::stoppableRun()
 
         chunkAttrib.chunkSize = settings.framesPerPeriod * N_CHANS * sizeof(AUDIO_DATA_TYPE);
         chunkAttrib.timestamp = msec;
+        chunkAttrib.blockId++;
 
         cycBuf->insertChunk(periodBuffer, chunkAttrib);
     }
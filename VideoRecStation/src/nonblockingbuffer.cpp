@@ -20,7 +20,6 @@
 #include <iostream>
 #include <stdlib.h>
 #include <string.h>
-#include <QMutexLocker>
 
 #include "nonblockingbuffer.h"
 
@@ -31,10 +30,16 @@ NonBlockingBuffer::NonBlockingBuffer(int _bufSize, long _chunkSize)
 {
     insertPtr = 0;              // if getPtr == insertPtr the buffer is empty
     getPtr = 0;
-    bufSize = _bufSize+1;       // to store N items we use N+1 slots to simplify
-                                // head/tail pointer arithmetics
+    holding = false;
+    bufSize = _bufSize+2;       // to store N items we use N+2 slots: one to
+                                // simplify head/tail pointer arithmetics and
+                                // one for the chunk held by the consumer
     chunkSize = _chunkSize;
-    buffMutex = new QMutex();
+    overrunCount = 0;
+    underrunCount = 0;
+    chunksIn = 0;
+    chunksOut = 0;
+    peakOccupancy = 0;
 
     // Allocate buffers
     dataBuf = (char*)malloc(bufSize * chunkSize);
@@ -44,6 +49,13 @@ NonBlockingBuffer::NonBlockingBuffer(int _bufSize, long _chunkSize)
         abort();
     }
 
+    insertTimes = (uint64_t*)malloc(bufSize * sizeof(uint64_t));
+    if (!insertTimes)
+    {
+        cerr << "Cannot allocate memory for non-blocking buffer" << endl;
+        abort();
+    }
+
     zeroChunk = (char*)malloc(chunkSize);
     if (!zeroChunk)
     {
@@ -58,42 +70,96 @@ NonBlockingBuffer::NonBlockingBuffer(int _bufSize, long _chunkSize)
 NonBlockingBuffer::~NonBlockingBuffer()
 {
     free(zeroChunk);
+    free(insertTimes);
     free(dataBuf);
-    delete(buffMutex);
 }
 
 
 void NonBlockingBuffer::insertChunk(void* _data)
 {
-    QMutexLocker locker(buffMutex);
-
-    // if the buffer is full discard the data
-    if((insertPtr+1) % bufSize == getPtr)
+    int ptr = insertPtr.load(memory_order_relaxed);
+    int nextPtr = (ptr+1) % bufSize;
+    int freePtr;
+    int occupied;
+
+    // if the buffer is full discard the data. The acquire pairs with the
+    // consumer's release, so the slot is not overwritten while being read.
+    freePtr = getPtr.load(memory_order_acquire);
+    if(nextPtr == freePtr)
     {
-        // cerr << "Non-blocking buffer overflow, discarding the data" << endl;
+        overrunCount.store(overrunCount.load(memory_order_relaxed) + 1, memory_order_relaxed);
         return;
     }
 
-    // insert the data into the circular buffer
-    memcpy(dataBuf + chunkSize * insertPtr, _data, chunkSize);
-    insertPtr = (insertPtr+1) % bufSize;
+    // insert the data into the circular buffer and publish it
+    memcpy(dataBuf + chunkSize * ptr, _data, chunkSize);
+    insertTimes[ptr] = LatencyHistogram::now();
+    insertPtr.store(nextPtr, memory_order_release);
+
+    chunksIn.store(chunksIn.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    occupied = (nextPtr - freePtr + bufSize) % bufSize;
+    if (uint64_t(occupied) > peakOccupancy.load(memory_order_relaxed))
+    {
+        peakOccupancy.store(occupied, memory_order_relaxed);
+    }
 }
 
 
 void* NonBlockingBuffer::getChunk()
 {
-    void*           res;
-    QMutexLocker    locker(buffMutex);
+    int ptr = getPtr.load(memory_order_relaxed);
+
+    // Release the chunk returned last time
+    if (holding)
+    {
+        ptr = (ptr+1) % bufSize;
+        getPtr.store(ptr, memory_order_release);
+        holding = false;
+    }
 
-    if(insertPtr==getPtr)
+    if(insertPtr.load(memory_order_acquire) == ptr)
     {
-        // cerr << "Non-blocking buffer underflow, returning zeros" << endl;
+        underrunCount.store(underrunCount.load(memory_order_relaxed) + 1, memory_order_relaxed);
         return(zeroChunk);
     }
     else
     {
-        res = dataBuf + chunkSize * getPtr;
-        getPtr = (getPtr+1) % bufSize;
-        return(res);
+        holding = true;
+        chunksOut.store(chunksOut.load(memory_order_relaxed) + 1, memory_order_relaxed);
+        latencyHist.record(LatencyHistogram::now() - insertTimes[ptr]);
+        return(dataBuf + chunkSize * ptr);
     }
 }
+
+
+uint64_t NonBlockingBuffer::overruns()
+{
+    return(overrunCount.load(memory_order_relaxed));
+}
+
+
+uint64_t NonBlockingBuffer::underruns()
+{
+    return(underrunCount.load(memory_order_relaxed));
+}
+
+
+BufferStats NonBlockingBuffer::stats()
+{
+    BufferStats stats;
+    int         ptr = getPtr.load(memory_order_relaxed);
+
+    stats.size = bufSize - 1;
+    stats.occupancy = (insertPtr.load(memory_order_relaxed) - ptr + bufSize) % bufSize;
+    stats.peakOccupancy = peakOccupancy.load(memory_order_relaxed);
+    stats.chunksIn = chunksIn.load(memory_order_relaxed);
+    stats.chunksOut = chunksOut.load(memory_order_relaxed);
+
+    return(stats);
+}
+
+
+const LatencyHistogram& NonBlockingBuffer::latency()
+{
+    return(latencyHist);
+}
@@ -20,26 +20,64 @@
 #ifndef NONBLOCKINGBUFFER_H_
 #define NONBLOCKINGBUFFER_H_
 
-#include <QMutex>
+#include <stdint.h>
+#include <atomic>
 
+#include "bufferstats.h"
+
+//! Wait-free single-producer single-consumer buffer of fixed-size chunks.
+/*!
+ * Neither side ever waits for the other: if the buffer is full the
+ * producer's chunk is discarded (overrun), if it is empty the consumer gets
+ * a chunk of zeros (underrun). The producer and the consumer only share the
+ * two atomic ring indices, so a real-time consumer cannot be blocked by a
+ * lower-priority producer.
+ */
 class NonBlockingBuffer {
 public:
     NonBlockingBuffer(int _bufSize, long _chunkSize);
     virtual ~NonBlockingBuffer();
+
+    //! Copy a chunk into the buffer. Should only be called by the producer.
     void insertChunk(void* _data);
 
     // Acquire a chunk and return a pointer to it. The chunk is implicitly
-    // released next time getChunk is called.
+    // released next time getChunk is called. Should only be called by the
+    // consumer.
     void* getChunk();
 
+    //! Number of chunks discarded because the buffer was full.
+    uint64_t overruns();
+
+    //! Number of times the consumer got zeros because the buffer was empty.
+    uint64_t underruns();
+
+    //! Occupancy statistics (in chunks) so far. Can be called from any thread.
+    BufferStats stats();
+
+    /*!
+     * Histogram of the time (in microseconds) the chunks spent in the buffer
+     * between insertChunk() and getChunk(). Can be read from any thread.
+     */
+    const LatencyHistogram& latency();
+
 private:
-    QMutex* buffMutex;
-    char*   dataBuf;
-    char*   zeroChunk;
-    int     bufSize;
-    long    chunkSize;
-    int     insertPtr;
-    int     getPtr;
+    char*       dataBuf;
+    uint64_t*   insertTimes;        // monotonic time each slot was filled, in microseconds
+    char*       zeroChunk;
+    int         bufSize;
+    long        chunkSize;
+
+    std::atomic<int>        insertPtr;      // written by the producer only
+    std::atomic<int>        getPtr;         // written by the consumer only
+    bool                    holding;        // consumer holds the chunk at getPtr
+
+    std::atomic<uint64_t>   overrunCount;
+    std::atomic<uint64_t>   underrunCount;
+    std::atomic<uint64_t>   chunksIn;
+    std::atomic<uint64_t>   chunksOut;
+    std::atomic<uint64_t>   peakOccupancy;
+    LatencyHistogram        latencyHist;
 };
 
 #endif /* NONBLOCKINGBUFFER_H_ */
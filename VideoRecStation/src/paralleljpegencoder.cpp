@@ -0,0 +1,224 @@
+/*
+ * paralleljpegencoder.cpp
+ *
+ * Author: Andrey Zhdanov
+ * Copyright (C) 2014 BioMag Laboratory, Helsinki University Central Hospital
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+
+#include "paralleljpegencoder.h"
+
+using namespace std;
+
+// JPEG markers
+#define JPEG_MARKER_SOF0    0xc0
+#define JPEG_MARKER_SOF1    0xc1
+#define JPEG_MARKER_SOF2    0xc2
+#define JPEG_MARKER_RST0    0xd0
+#define JPEG_MARKER_SOI     0xd8
+#define JPEG_MARKER_EOI     0xd9
+#define JPEG_MARKER_SOS     0xda
+
+// Restart markers cycle through RST0..RST7
+#define N_RST_MARKERS       8
+
+
+//---------------------------------------------------------------------
+// Helpers for walking through the marker segments preceding the
+// entropy-coded data
+//
+
+//! Return the offset of the first byte after the SOS segment. Store the offset of the SOF segment in _sofOffset.
+static int findScanData(unsigned char* _jpg, int _len, int* _sofOffset)
+{
+    int pos = 2;    // skip SOI
+    int segLen;
+
+    *_sofOffset = -1;
+
+    if (_len < 2 || _jpg[0] != 0xff || _jpg[1] != JPEG_MARKER_SOI)
+    {
+        cerr << "Slice is not a JPEG image!" << endl;
+        abort();
+    }
+
+    while (pos + 4 <= _len)
+    {
+        if (_jpg[pos] != 0xff)
+        {
+            cerr << "Corrupted JPEG header in a slice!" << endl;
+            abort();
+        }
+
+        segLen = (_jpg[pos+2] << 8) | _jpg[pos+3];
+
+        if (_jpg[pos+1] == JPEG_MARKER_SOF0 || _jpg[pos+1] == JPEG_MARKER_SOF1 || _jpg[pos+1] == JPEG_MARKER_SOF2)
+        {
+            *_sofOffset = pos;
+        }
+
+        if (_jpg[pos+1] == JPEG_MARKER_SOS)
+        {
+            return(pos + 2 + segLen);
+        }
+
+        pos += 2 + segLen;
+    }
+
+    cerr << "No scan found in a slice!" << endl;
+    abort();
+}
+
+
+ParallelJpegEncoder::ParallelJpegEncoder(int _width, int _height, PixelFormat _format, int _quality, int _nSlices)
+{
+    JpegEncoder*    probe;
+    int             mcuHeight;
+    int             nMcuRows;
+    int             mcuRowsPerSlice;
+    int             firstMcuRow;
+
+    width = _width;
+    height = _height;
+    rowSize = rawRowSize(_format, width);
+    curImage = NULL;
+
+    // Split the frame into slices of whole MCU rows, each (but the last) a
+    // multiple of N_RST_MARKERS MCU rows high
+    probe = new JpegEncoder(width, height, _format, _quality);
+    mcuHeight = probe->mcuHeight();
+    delete probe;
+
+    nMcuRows = (height + mcuHeight - 1) / mcuHeight;
+    mcuRowsPerSlice = (nMcuRows + _nSlices - 1) / _nSlices;
+    mcuRowsPerSlice = ((mcuRowsPerSlice + N_RST_MARKERS - 1) / N_RST_MARKERS) * N_RST_MARKERS;
+
+    maxSize = 0;
+    for (firstMcuRow = 0; firstMcuRow < nMcuRows; firstMcuRow += mcuRowsPerSlice)
+    {
+        Slice   slice;
+        int     sliceHeight = min(mcuRowsPerSlice * mcuHeight, height - firstMcuRow * mcuHeight);
+
+        slice.firstMcuRow = firstMcuRow;
+        slice.firstRow = firstMcuRow * mcuHeight;
+        slice.encoder = new JpegEncoder(width, sliceHeight, _format, _quality, 1);
+        slice.jpgBuf = (unsigned char*)malloc(slice.encoder->maxOutputSize());
+        slice.jpgSize = 0;
+        if (!slice.jpgBuf)
+        {
+            cerr << "Cannot allocate memory!" << endl;
+            abort();
+        }
+
+        maxSize += slice.encoder->maxOutputSize();
+        slices.push_back(slice);
+    }
+
+    runner = new SliceRunner(this, slices.size());
+}
+
+
+ParallelJpegEncoder::~ParallelJpegEncoder()
+{
+    delete runner;
+
+    for (unsigned int i=0; i<slices.size(); i++)
+    {
+        delete slices[i].encoder;
+        free(slices[i].jpgBuf);
+    }
+}
+
+
+int ParallelJpegEncoder::maxOutputSize()
+{
+    return(maxSize);
+}
+
+
+int ParallelJpegEncoder::sliceCount()
+{
+    return(slices.size());
+}
+
+
+void ParallelJpegEncoder::setQuality(int _quality)
+{
+    // The slice threads are idle between the calls to encode()
+    for (unsigned int i=0; i<slices.size(); i++)
+    {
+        slices[i].encoder->setQuality(_quality);
+    }
+}
+
+
+void ParallelJpegEncoder::processSlice(int _idx)
+{
+    Slice& slice = slices[_idx];
+    slice.jpgSize = slice.encoder->encode(curImage + slice.firstRow * rowSize, slice.jpgBuf);
+}
+
+
+int ParallelJpegEncoder::encode(unsigned char* _image, unsigned char* _outBuf)
+{
+    int             outLen;
+    int             scanStart;
+    int             sofOffset;
+    int             nextMcuRow;
+
+    // Compress all the slices
+    curImage = _image;
+    runner->run();
+
+    // Header of the first slice, with the height of the whole frame
+    scanStart = findScanData(slices[0].jpgBuf, slices[0].jpgSize, &sofOffset);
+    if (sofOffset < 0)
+    {
+        cerr << "No frame header found in a slice!" << endl;
+        abort();
+    }
+    memcpy(_outBuf, slices[0].jpgBuf, scanStart);
+    _outBuf[sofOffset + 5] = (height >> 8) & 0xff;
+    _outBuf[sofOffset + 6] = height & 0xff;
+    outLen = scanStart;
+
+    // Entropy-coded data of all the slices (without EOI), separated by restart markers
+    for (unsigned int i=0; i<slices.size(); i++)
+    {
+        if (i > 0)
+        {
+            scanStart = findScanData(slices[i].jpgBuf, slices[i].jpgSize, &sofOffset);
+        }
+
+        memcpy(_outBuf + outLen, slices[i].jpgBuf + scanStart, slices[i].jpgSize - scanStart - 2);
+        outLen += slices[i].jpgSize - scanStart - 2;
+
+        if (i + 1 < slices.size())
+        {
+            nextMcuRow = slices[i+1].firstMcuRow;
+            _outBuf[outLen++] = 0xff;
+            _outBuf[outLen++] = JPEG_MARKER_RST0 + (nextMcuRow - 1) % N_RST_MARKERS;
+        }
+    }
+
+    _outBuf[outLen++] = 0xff;
+    _outBuf[outLen++] = JPEG_MARKER_EOI;
+
+    return(outLen);
+}
+
@@ -0,0 +1,80 @@
+/*
+ * paralleljpegencoder.h
+ *
+ * Author: Andrey Zhdanov
+ * Copyright (C) 2014 BioMag Laboratory, Helsinki University Central Hospital
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PARALLELJPEGENCODER_H_
+#define PARALLELJPEGENCODER_H_
+
+#include <vector>
+
+#include "frameencoder.h"
+#include "jpegencoder.h"
+#include "slicerunner.h"
+
+//! JPEG compressor that encodes horizontal slices of a frame in parallel.
+/*!
+ * The frame is split into horizontal slices of whole MCU rows. Every slice
+ * is compressed as a separate image by its own JpegEncoder, with a restart
+ * marker after each MCU row, on its own thread (the first slice is
+ * compressed by the calling thread). Since the entropy coder is reset at
+ * every restart marker, the entropy-coded data of the slices can simply be
+ * concatenated, separated by restart markers, under the header of the first
+ * slice (with the image height patched). The result is a single baseline
+ * JPEG image that any decoder can read; it is byte-identical to the image
+ * JpegEncoder produces with a restart marker after every MCU row.
+ *
+ * Restart markers are numbered modulo 8, so each slice (except the last one)
+ * is a multiple of 8 MCU rows high. This limits the effective number of
+ * slices to the number of MCU rows divided by 8 (4 for colour and 8 for
+ * monochrome 640x480 frames).
+ */
+class ParallelJpegEncoder : public FrameEncoder, private SliceJob
+{
+public:
+    ParallelJpegEncoder(int _width, int _height, PixelFormat _format, int _quality, int _nSlices);
+    virtual ~ParallelJpegEncoder();
+
+    virtual int maxOutputSize();
+    virtual int encode(unsigned char* _image, unsigned char* _outBuf);
+    virtual void setQuality(int _quality);
+
+    //! Return the actual number of slices.
+    int sliceCount();
+
+private:
+    struct Slice
+    {
+        JpegEncoder*    encoder;
+        int             firstRow;       // in pixels
+        int             firstMcuRow;
+        unsigned char*  jpgBuf;
+        int             jpgSize;
+    };
+
+    virtual void processSlice(int _idx);
+
+    std::vector<Slice>          slices;
+    SliceRunner*                runner;
+    int                         width;
+    int                         rowSize;        // in bytes
+    int                         height;
+    int                         maxSize;
+    unsigned char*              curImage;
+};
+
+#endif /* PARALLELJPEGENCODER_H_ */
@@ -0,0 +1,53 @@
+/*
+ * pixelformat.h
+ *
+ * Author: Andrey Zhdanov
+ * Copyright (C) 2014 BioMag Laboratory, Helsinki University Central Hospital
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef PIXELFORMAT_H_
+#define PIXELFORMAT_H_
+
+//! Pixel formats of the raw frames delivered by the cameras.
+/*!
+ * The YUV formats use the IIDC byte order: YUV422 is U Y V Y for every two
+ * pixels, YUV411 is U Y Y V Y Y for every four pixels.
+ */
+enum PixelFormat
+{
+    PIXEL_FORMAT_MONO8,
+    PIXEL_FORMAT_RGB8,
+    PIXEL_FORMAT_YUV422,
+    PIXEL_FORMAT_YUV411
+};
+
+//! Size of a single row of pixels in bytes.
+inline int rawRowSize(PixelFormat _format, int _width)
+{
+    switch (_format)
+    {
+    case PIXEL_FORMAT_RGB8:
+        return(_width * 3);
+    case PIXEL_FORMAT_YUV422:
+        return(_width * 2);
+    case PIXEL_FORMAT_YUV411:
+        return(_width * 3 / 2);
+    default:
+        return(_width);
+    }
+}
+
+#endif /* PIXELFORMAT_H_ */
@@ -0,0 +1,134 @@
+/*
+ * ratecontroller.cpp
+ *
+ * Author: Andrey Zhdanov
+ * Copyright (C) 2014 BioMag Laboratory, Helsinki University Central Hospital
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <iostream>
+#include <algorithm>
+
+#include "config.h"
+#include "ratecontroller.h"
+
+using namespace std;
+
+
+RateController::RateController(int _cameraIdx, CycDataBuffer* _outBuf, FileWriter* _writer, int _quality,
+                               int _minQuality, int _maxQuality, int _nCompressorThreads)
+{
+    cameraIdx = _cameraIdx;
+    outBuf = _outBuf;
+    writer = _writer;
+    minQuality = _minQuality;
+    maxQuality = _maxQuality;
+    nCompressorThreads = (_nCompressorThreads > 0 ? _nCompressorThreads : 1);
+
+    if (maxQuality < minQuality)
+    {
+        cerr << "Maximal JPEG quality is lower than the minimal one, disabling rate control" << endl;
+        maxQuality = minQuality = _quality;
+    }
+    quality = max(minQuality, min(maxQuality, _quality));
+    frameQuality = quality;
+
+    nFrames = 0;
+    windowStart = 0;
+    encodeTime = 0;
+    writeTimeStart = 0;
+    prevOccupancy = 0;
+    compressorLoad = 0;
+    writerLoad = 0;
+}
+
+
+RateController::~RateController()
+{
+}
+
+
+int RateController::getQuality()
+{
+    return(quality);
+}
+
+
+void RateController::frameDone(uint64_t _timestamp, uint64_t _encodeTime, int _quality)
+{
+    if (_quality != frameQuality)
+    {
+        clog << "Camera " << cameraIdx + 1 << ": JPEG quality " << frameQuality << " -> " << _quality
+             << " from frame " << _timestamp
+             << " (compressor load " << int(compressorLoad * 100)
+             << "%, output buffer " << int(prevOccupancy * 100)
+             << "%, writer load " << int(writerLoad * 100) << "%)" << endl;
+        frameQuality = _quality;
+    }
+
+    if (nFrames == 0)
+    {
+        windowStart = _timestamp;
+        encodeTime = 0;
+        writeTimeStart = writer->getWriteTime();
+    }
+
+    nFrames++;
+    encodeTime += _encodeTime;
+
+    if (nFrames > RATE_CONTROL_FRAMES)
+    {
+        adjust(_timestamp);
+        nFrames = 0;
+    }
+}
+
+
+void RateController::adjust(uint64_t _timestamp)
+{
+    // The window spans nFrames-1 frame periods: from the first frame to the
+    // current one
+    double      windowLen = double(_timestamp - windowStart) * 1000;    // in microseconds
+    double      occupancy = outBuf->occupancy();
+    int         newQuality = quality;
+
+    // The pre-roll held by the writer is no backlog
+    occupancy = max(0.0, occupancy - double(writer->getPreRollBytes()) / outBuf->stats().size);
+
+    if (_timestamp <= windowStart)
+    {
+        return;
+    }
+
+    compressorLoad = (double(encodeTime) / nFrames) / (windowLen / (nFrames - 1)) / nCompressorThreads;
+    writerLoad = (writer->getWriteTime() - writeTimeStart) / windowLen;
+
+    if (occupancy > RATE_CONTROL_CRIT_OCC)
+    {
+        newQuality -= 2 * RATE_CONTROL_STEP_DOWN;
+    }
+    else if ((occupancy > RATE_CONTROL_HIGH_OCC && occupancy >= prevOccupancy) ||
+             compressorLoad > RATE_CONTROL_HIGH_LOAD || writerLoad > RATE_CONTROL_HIGH_LOAD)
+    {
+        newQuality -= RATE_CONTROL_STEP_DOWN;
+    }
+    else if (occupancy < RATE_CONTROL_LOW_OCC && compressorLoad < RATE_CONTROL_LOW_LOAD && writerLoad < RATE_CONTROL_LOW_LOAD)
+    {
+        newQuality += RATE_CONTROL_STEP_UP;
+    }
+
+    prevOccupancy = occupancy;
+    quality = max(minQuality, min(maxQuality, newQuality));
+}
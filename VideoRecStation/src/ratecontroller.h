@@ -0,0 +1,92 @@
+/*
+ * ratecontroller.h
+ *
+ * Author: Andrey Zhdanov
+ * Copyright (C) 2014 BioMag Laboratory, Helsinki University Central Hospital
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RATECONTROLLER_H_
+#define RATECONTROLLER_H_
+
+#include <atomic>
+#include <stdint.h>
+
+#include "cycdatabuffer.h"
+#include "filewriter.h"
+
+//! Closed-loop controller adapting the JPEG quality of a camera to the available headroom.
+/*!
+ * The controller is fed the compression time of every frame (in the order
+ * the frames are inserted into the output buffer) and, every
+ * RATE_CONTROL_FRAMES frames, looks at three signals:
+ *
+ *  - compressor load: compression time per frame relative to the frame
+ *    period (divided by the number of threads compressing the frames),
+ *  - occupancy of the compressed-frame buffer and its trend,
+ *  - writer load: the fraction of the time the file writer spends writing.
+ *
+ * If the output buffer is filling up or either load is close to 1, the
+ * quality is lowered by RATE_CONTROL_STEP_DOWN (twice that if the buffer is
+ * close to overflowing). If everything is idle, the quality is raised back
+ * by RATE_CONTROL_STEP_UP. The quality always stays within the configured
+ * bounds.
+ *
+ * The quality a frame was actually compressed with is reported back to
+ * frameDone(); every change is logged together with the timestamp of the
+ * first frame compressed with the new quality (frames that were already
+ * being compressed when the quality was changed keep the old one).
+ *
+ * frameDone() calls should be serialized; getQuality() can be called from
+ * any thread.
+ */
+class RateController
+{
+public:
+    RateController(int _cameraIdx, CycDataBuffer* _outBuf, FileWriter* _writer, int _quality,
+                   int _minQuality, int _maxQuality, int _nCompressorThreads);
+    virtual ~RateController();
+
+    //! Quality to be used for the next frame.
+    int getQuality();
+
+    //! Account for a frame compressed with quality _quality. _encodeTime is in microseconds.
+    void frameDone(uint64_t _timestamp, uint64_t _encodeTime, int _quality);
+
+private:
+    void adjust(uint64_t _timestamp);
+
+    int                 cameraIdx;
+    CycDataBuffer*      outBuf;
+    FileWriter*         writer;
+    int                 minQuality;
+    int                 maxQuality;
+    int                 nCompressorThreads;
+    std::atomic<int>    quality;
+    int                 frameQuality;       // quality of the last frame passed to frameDone()
+
+    // Current measurement window
+    int                 nFrames;
+    uint64_t            windowStart;        // timestamp of the first frame, in ms
+    uint64_t            encodeTime;         // in microseconds
+    uint64_t            writeTimeStart;     // writer's total write time at the window start
+    double              prevOccupancy;
+
+    // Signals measured during the last complete window
+    double              compressorLoad;
+    double              writerLoad;
+};
+
+#endif /* RATECONTROLLER_H_ */
@@ -0,0 +1,103 @@
+/*
+ * recordingepoch.cpp
+ *
+ * Author: Andrey Zhdanov
+ * Copyright (C) 2014 BioMag Laboratory, Helsinki University Central Hospital
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <time.h>
+#include <algorithm>
+
+#include "recordingepoch.h"
+
+using namespace std;
+
+
+RecordingEpoch::RecordingEpoch()
+{
+    seq = 0;
+    startTime = UINT64_MAX;
+    stopTime = UINT64_MAX;
+    prevStartTime = UINT64_MAX;
+    prevStopTime = UINT64_MAX;
+}
+
+
+void RecordingEpoch::start(uint64_t _timestamp)
+{
+    beginWrite();
+    if (startTime.load(memory_order_relaxed) != UINT64_MAX)
+    {
+        prevStartTime.store(startTime.load(memory_order_relaxed), memory_order_relaxed);
+        prevStopTime.store(min(stopTime.load(memory_order_relaxed), _timestamp), memory_order_relaxed);
+    }
+    startTime.store(_timestamp, memory_order_relaxed);
+    stopTime.store(UINT64_MAX, memory_order_relaxed);
+    endWrite();
+}
+
+
+void RecordingEpoch::stop(uint64_t _timestamp)
+{
+    beginWrite();
+    stopTime.store(_timestamp, memory_order_relaxed);
+    endWrite();
+}
+
+
+bool RecordingEpoch::isRec(uint64_t _timestamp)
+{
+    uint32_t    seqBefore;
+    uint64_t    start;
+    uint64_t    stop;
+    uint64_t    prevStart;
+    uint64_t    prevStop;
+
+    // Retry if the times are being written
+    do
+    {
+        seqBefore = seq.load(memory_order_acquire);
+        start = startTime.load(memory_order_relaxed);
+        stop = stopTime.load(memory_order_relaxed);
+        prevStart = prevStartTime.load(memory_order_relaxed);
+        prevStop = prevStopTime.load(memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seqBefore & 1) || seq.load(memory_order_relaxed) != seqBefore);
+
+    return((_timestamp >= start && _timestamp < stop) || (_timestamp >= prevStart && _timestamp < prevStop));
+}
+
+
+uint64_t RecordingEpoch::now()
+{
+    struct timespec timestamp;
+
+    clock_gettime(CLOCK_REALTIME, &timestamp);
+    return(timestamp.tv_nsec / 1000000 + timestamp.tv_sec * 1000);
+}
+
+
+void RecordingEpoch::beginWrite()
+{
+    seq.store(seq.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+
+void RecordingEpoch::endWrite()
+{
+    seq.store(seq.load(memory_order_relaxed) + 1, memory_order_release);
+}
@@ -0,0 +1,74 @@
+/*
+ * recordingepoch.h
+ *
+ * Author: Andrey Zhdanov
+ * Copyright (C) 2014 BioMag Laboratory, Helsinki University Central Hospital
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RECORDINGEPOCH_H_
+#define RECORDINGEPOCH_H_
+
+#include <stdint.h>
+#include <atomic>
+
+//! Start and stop time of a recording shared by all the streams.
+/*!
+ * Instead of switching recording on and off in every buffer one after
+ * another, the buffers compare the timestamp of every chunk against the
+ * epoch (see CycDataBuffer::setRecordingEpoch()). All the streams thus start
+ * and stop recording at the same instant, regardless of when their chunks
+ * reach the buffers.
+ *
+ * The times are in milliseconds of the real-time clock, like the chunk
+ * timestamps. The previous recording is remembered too, so that the chunks
+ * captured before a stop but compressed after a quick restart are still
+ * recorded.
+ *
+ * start() and stop() should only be called from one thread; isRec() can be
+ * called from any thread. The times are published with a seqlock.
+ */
+class RecordingEpoch
+{
+public:
+    RecordingEpoch();
+
+    //! Record the chunks with timestamps from _timestamp on.
+    void start(uint64_t _timestamp);
+
+    //! Do not record the chunks with timestamps from _timestamp on.
+    void stop(uint64_t _timestamp);
+
+    //! Return true if the chunk with timestamp _timestamp should be recorded.
+    bool isRec(uint64_t _timestamp);
+
+    //! Current time in the units of the chunk timestamps.
+    static uint64_t now();
+
+private:
+    //! Start a write of the times.
+    void beginWrite();
+
+    //! Finish a write of the times.
+    void endWrite();
+
+    std::atomic<uint32_t>   seq;            // odd while the times are being written
+    std::atomic<uint64_t>   startTime;
+    std::atomic<uint64_t>   stopTime;       // UINT64_MAX while recording
+    std::atomic<uint64_t>   prevStartTime;
+    std::atomic<uint64_t>   prevStopTime;
+};
+
+#endif /* RECORDINGEPOCH_H_ */
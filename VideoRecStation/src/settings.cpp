@@ -18,12 +18,44 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
 #include <QSettings>
 #include <QRect>
 
 #include "settings.h"
+#include "frameencoder.h"
 #include "config.h"
 
+using namespace std;
+
+//! Convert the name of an overflow policy to OverflowPolicy.
+static OverflowPolicy parseOverflowPolicy(const QString& _mode)
+{
+    if (_mode == "block")
+    {
+        return(OVERFLOW_BLOCK);
+    }
+    if (_mode == "drop_newest")
+    {
+        return(OVERFLOW_DROP_NEWEST);
+    }
+    if (_mode == "catch_up")
+    {
+        return(OVERFLOW_CATCH_UP);
+    }
+    if (_mode == "spill")
+    {
+        return(OVERFLOW_SPILL);
+    }
+    if (_mode != "abort")
+    {
+        cerr << "Unknown overflow policy " << _mode.toLocal8Bit().data() << ", using abort" << endl;
+    }
+    return(OVERFLOW_ABORT);
+}
+
+
 Settings::Settings()
 {
     QSettings settings(ORG_NAME, APP_NAME);
@@ -36,9 +68,73 @@ Settings::Settings()
     // JPEG quality
     jpgQuality = settings.value("video/jpeg_quality", 80).toInt();
 
+    // Adapt JPEG quality to CPU and disk headroom, within the given bounds
+    rateControl = settings.value("video/rate_control", false).toBool();
+    jpgQualityMin = settings.value("video/jpeg_quality_min", 50).toInt();
+    jpgQualityMax = settings.value("video/jpeg_quality_max", jpgQuality).toInt();
+
+    // Video encoder backend: "libjpeg" or "turbojpeg" for JPEG, "zstd" or
+    // "lz4" for lossless video
+    encoderBackend = settings.value("video/encoder_backend", "libjpeg").toString();
+
+    // Do not let a typo (or a build without the codec) turn a lossless
+    // recording into a lossy one
+    if (!FrameEncoder::isAvailable(encoderBackend))
+    {
+        cerr << "Cannot use video/encoder_backend " << encoderBackend.toLocal8Bit().data() << endl;
+        abort();
+    }
+
+    // Compression level for zstd, acceleration factor for LZ4
+    losslessLevel = settings.value("video/lossless_level", 1).toInt();
+
+    // Number of horizontal slices every frame is split into for compressing
+    // in parallel (not used with the compressor pool). For JPEG only
+    // supported by the libjpeg backend.
+    encoderSlices = settings.value("video/encoder_slices", (encoderBackend == "zstd" || encoderBackend == "lz4") ? 4 : 1).toInt();
+
+    // Number of threads in the compressor pool shared by all the cameras. If
+    // 0, every camera gets its own compressor thread.
+    compressorThreads = settings.value("video/compressor_threads", 0).toInt();
+
     // Use color mode
     color = settings.value("video/color", true).toBool();
 
+    // Format of the colour frames sent by the cameras: "rgb8", "yuv422" or
+    // "yuv411". YUV frames are compressed without colour conversion and use
+    // less FireWire bandwidth.
+    colorFormat = settings.value("video/color_format", "rgb8").toString();
+    if (!color)
+    {
+        pixelFormat = PIXEL_FORMAT_MONO8;
+    }
+    else if (colorFormat == "yuv422")
+    {
+        pixelFormat = PIXEL_FORMAT_YUV422;
+    }
+    else if (colorFormat == "yuv411")
+    {
+        pixelFormat = PIXEL_FORMAT_YUV411;
+    }
+    else
+    {
+        if (colorFormat != "rgb8")
+        {
+            cerr << "Unknown color format " << colorFormat.toLocal8Bit().data() << ", using rgb8" << endl;
+        }
+        pixelFormat = PIXEL_FORMAT_RGB8;
+    }
+
+    // Hand DMA frames to the compressor instead of copying them
+    zeroCopyCapture = settings.value("video/zero_copy_capture", false).toBool();
+
+    // Depth of the libdc1394 DMA ring
+    dmaBuffers = settings.value("video/dma_buffers", zeroCopyCapture ? N_ZERO_COPY_BUFFERS : N_CAMERA_BUFFERS).toUInt();
+
+    // What to do when the raw video buffer overflows (see misc/overflow_policy)
+    rawOverflowMode = settings.value("video/raw_overflow_policy", "abort").toString();
+    rawOverflowPolicy = parseOverflowPolicy(rawOverflowMode);
+
     // Capture settings
     for (unsigned int i=0; i<MAX_CAMERAS; i++)
     {
@@ -89,6 +185,54 @@ Settings::Settings()
 
     // Camera dummy mode
     dummyMode = settings.value("misc/dummy_mode", false).toBool();
+
+    // Back the circular buffers with huge pages (explicit if reserved in
+    // the system, transparent otherwise) and lock them in memory, so that
+    // the real-time threads never take a page fault
+    bufferHugePages = settings.value("misc/buffer_huge_pages", false).toBool();
+    lockBuffers = settings.value("misc/lock_buffers", false).toBool();
+
+    // The circular buffers of all the streams share a single memory arena.
+    // Every buffer is sized to hold buffer_latency seconds of its stream
+    // (raw video, compressed video or audio). The size of the arena is in
+    // bytes; if 0, the arena is sized for all the cameras found. Can exceed
+    // 4 GB to hold minutes of video.
+    bufferLatency = settings.value("misc/buffer_latency", 3.0).toDouble();
+    arenaSize = settings.value("misc/buffer_arena_size", qulonglong(0)).toULongLong();
+
+    // Seconds of compressed video and audio before pressing Start that are
+    // included in the recording. The buffers are enlarged to hold them.
+    preRoll = settings.value("misc/pre_roll", 0.0).toDouble();
+
+    // Write the files of all the streams from a single I/O thread, through
+    // io_uring if available, instead of every stream writing its own files
+    sharedIoEngine = settings.value("misc/shared_io_engine", false).toBool();
+
+    // Write the files with O_DIRECT, keeping the recorded data out of the
+    // page cache
+    directIo = settings.value("misc/direct_io", false).toBool();
+
+    // Preallocate the files in extents of this many MB to avoid
+    // fragmentation, and keep only the last dirty_window MB (written, but not
+    // yet on the disk) of every file in the page cache. 0 disables.
+    fileExtentSize = settings.value("misc/file_extent_size", 0).toInt();
+    dirtyWindow = settings.value("misc/dirty_window", 0).toInt();
+
+    // Write an index of the chunks (timestamp, offset and size) next to every
+    // audio and video file, so that readers can seek without scanning the file
+    writeIndex = settings.value("misc/write_index", true).toBool();
+
+    // What to do when a compressed video or audio buffer overflows (e.g.
+    // because the disk is too slow): "abort", "block" (wait for the disk for
+    // at most overflow_block_timeout ms, then drop the data), "drop_newest",
+    // "catch_up" (the writer skips the oldest data it is behind with, the
+    // newest data is dropped if the buffer fills up while it is writing) or
+    // "spill" (write the data to overflow files in the overflow_spill_path
+    // folder, preferably on another disk)
+    overflowMode = settings.value("misc/overflow_policy", "abort").toString();
+    overflowPolicy = parseOverflowPolicy(overflowMode);
+    overflowTimeout = settings.value("misc/overflow_block_timeout", 100).toInt();
+    overflowSpillPath = settings.value("misc/overflow_spill_path", "").toString();
 }
 
 Settings::~Settings()
@@ -96,7 +240,18 @@ Settings::~Settings()
     QSettings settings(ORG_NAME, APP_NAME);
 
     settings.setValue("video/jpeg_quality", jpgQuality);
+    settings.setValue("video/rate_control", rateControl);
+    settings.setValue("video/jpeg_quality_min", jpgQualityMin);
+    settings.setValue("video/jpeg_quality_max", jpgQualityMax);
+    settings.setValue("video/encoder_backend", encoderBackend);
+    settings.setValue("video/lossless_level", losslessLevel);
+    settings.setValue("video/encoder_slices", encoderSlices);
+    settings.setValue("video/compressor_threads", compressorThreads);
     settings.setValue("video/color", color);
+    settings.setValue("video/color_format", colorFormat);
+    settings.setValue("video/zero_copy_capture", zeroCopyCapture);
+    settings.setValue("video/dma_buffers", dmaBuffers);
+    settings.setValue("video/raw_overflow_policy", rawOverflowMode);
     for (unsigned int i=0; i<MAX_CAMERAS; i++)
     {
         settings.setValue(QString("video/camera_%1_shutter").arg(i+1), videoShutters[i]);
@@ -123,6 +278,19 @@ Settings::~Settings()
 
     settings.setValue("misc/data_storage_path", storagePath);
     settings.setValue("misc/dummy_mode", dummyMode);
+    settings.setValue("misc/buffer_huge_pages", bufferHugePages);
+    settings.setValue("misc/lock_buffers", lockBuffers);
+    settings.setValue("misc/buffer_latency", bufferLatency);
+    settings.setValue("misc/buffer_arena_size", qulonglong(arenaSize));
+    settings.setValue("misc/pre_roll", preRoll);
+    settings.setValue("misc/shared_io_engine", sharedIoEngine);
+    settings.setValue("misc/direct_io", directIo);
+    settings.setValue("misc/file_extent_size", fileExtentSize);
+    settings.setValue("misc/dirty_window", dirtyWindow);
+    settings.setValue("misc/write_index", writeIndex);
+    settings.setValue("misc/overflow_policy", overflowMode);
+    settings.setValue("misc/overflow_block_timeout", overflowTimeout);
+    settings.setValue("misc/overflow_spill_path", overflowSpillPath);
 
     settings.sync();
 }
@@ -21,7 +21,11 @@
 #define SETTINGS_H_
 
 #include <QRect>
+#include <stdint.h>
+#include <QString>
 #include <common.h>
+#include "pixelformat.h"
+#include "cycdatabuffer.h"
 
 //! Application-wide settings preserved across multiple invocations.
 /*!
@@ -43,7 +47,20 @@ public:
 
     // video
     int             jpgQuality;
+    bool            rateControl;
+    int             jpgQualityMin;
+    int             jpgQualityMax;
+    QString         encoderBackend;
+    int             losslessLevel;
+    int             encoderSlices;
+    int             compressorThreads;
     bool            color;
+    QString         colorFormat;
+    PixelFormat     pixelFormat;        // derived from color and colorFormat
+    bool            zeroCopyCapture;
+    unsigned int    dmaBuffers;
+    QString         rawOverflowMode;
+    OverflowPolicy  rawOverflowPolicy;  // derived from rawOverflowMode
 
     // audio
     unsigned int    sampRate;
@@ -64,6 +81,20 @@ public:
     // misc
     QString         storagePath;
     bool            dummyMode;
+    bool            bufferHugePages;
+    bool            lockBuffers;
+    double          bufferLatency;      // in seconds
+    double          preRoll;            // in seconds
+    uint64_t        arenaSize;          // in bytes, 0 for automatic
+    bool            sharedIoEngine;
+    bool            directIo;
+    int             fileExtentSize;     // in MB, 0 for no preallocation
+    int             dirtyWindow;        // in MB, 0 to leave flushing to the kernel
+    bool            writeIndex;
+    QString         overflowMode;
+    OverflowPolicy  overflowPolicy;     // derived from overflowMode
+    int             overflowTimeout;    // in milliseconds
+    QString         overflowSpillPath;
     bool            controlOnTop;
     double          lowDiskSpaceWarning;
     bool            confirmStop;
@@ -0,0 +1,99 @@
+/*
+ * slicerunner.cpp
+ *
+ * Author: Andrey Zhdanov
+ * Copyright (C) 2014 BioMag Laboratory, Helsinki University Central Hospital
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "slicerunner.h"
+
+
+SliceJob::~SliceJob()
+{
+}
+
+
+SliceRunner::SliceRunner(SliceJob* _job, int _nSlices)
+{
+    job = _job;
+    stopping = false;
+
+    for (int i=1; i<_nSlices; i++)
+    {
+        threads.push_back(new SliceThread(this, i));
+    }
+
+    for (unsigned int i=0; i<threads.size(); i++)
+    {
+        threads[i]->start();
+    }
+}
+
+
+SliceRunner::~SliceRunner()
+{
+    stopping = true;
+    for (unsigned int i=0; i<threads.size(); i++)
+    {
+        threads[i]->startSem.release();
+        threads[i]->stop();
+        delete threads[i];
+    }
+}
+
+
+void SliceRunner::run()
+{
+    for (unsigned int i=0; i<threads.size(); i++)
+    {
+        threads[i]->startSem.release();
+    }
+
+    job->processSlice(0);
+
+    for (unsigned int i=0; i<threads.size(); i++)
+    {
+        threads[i]->doneSem.acquire();
+    }
+}
+
+
+SliceRunner::SliceThread::SliceThread(SliceRunner* _runner, int _idx)
+{
+    runner = _runner;
+    idx = _idx;
+}
+
+
+SliceRunner::SliceThread::~SliceThread()
+{
+}
+
+
+void SliceRunner::SliceThread::stoppableRun()
+{
+    while (true)
+    {
+        startSem.acquire();
+        if (runner->stopping)
+        {
+            return;
+        }
+
+        runner->job->processSlice(idx);
+        doneSem.release();
+    }
+}
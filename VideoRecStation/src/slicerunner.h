@@ -0,0 +1,77 @@
+/*
+ * slicerunner.h
+ *
+ * Author: Andrey Zhdanov
+ * Copyright (C) 2014 BioMag Laboratory, Helsinki University Central Hospital
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SLICERUNNER_H_
+#define SLICERUNNER_H_
+
+#include <vector>
+#include <QSemaphore>
+
+#include "stoppablethread.h"
+
+//! Work split into a fixed number of independent slices.
+class SliceJob
+{
+public:
+    virtual ~SliceJob();
+
+    //! Process a single slice. Called concurrently for different slices.
+    virtual void processSlice(int _idx) = 0;
+};
+
+//! Processes the slices of a job in parallel on a set of long-lived threads.
+/*!
+ * Every call to run() processes all the slices of the job: slice 0 on the
+ * calling thread and every other slice on its own helper thread. The helper
+ * threads sleep between the calls.
+ */
+class SliceRunner
+{
+public:
+    SliceRunner(SliceJob* _job, int _nSlices);
+    virtual ~SliceRunner();
+
+    //! Process all the slices and return when they are done.
+    void run();
+
+private:
+    class SliceThread : public StoppableThread
+    {
+    public:
+        SliceThread(SliceRunner* _runner, int _idx);
+        virtual ~SliceThread();
+
+        QSemaphore  startSem;
+        QSemaphore  doneSem;
+
+    protected:
+        virtual void stoppableRun();
+
+    private:
+        SliceRunner*    runner;
+        int             idx;
+    };
+
+    SliceJob*                   job;
+    std::vector<SliceThread*>   threads;    // threads[i] processes slice i+1
+    volatile bool               stopping;
+};
+
+#endif /* SLICERUNNER_H_ */
@@ -0,0 +1,85 @@
+/*
+ * turbojpegencoder.cpp
+ *
+ * Author: Andrey Zhdanov
+ * Copyright (C) 2014 BioMag Laboratory, Helsinki University Central Hospital
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_TURBOJPEG
+
+#include <stdlib.h>
+#include <iostream>
+
+#include "turbojpegencoder.h"
+
+using namespace std;
+
+
+TurboJpegEncoder::TurboJpegEncoder(int _width, int _height, PixelFormat _format, int _quality)
+{
+    width = _width;
+    height = _height;
+    pixelFormat = (_format == PIXEL_FORMAT_RGB8 ? TJPF_RGB : TJPF_GRAY);
+    subsamp = (_format == PIXEL_FORMAT_RGB8 ? TJSAMP_420 : TJSAMP_GRAY);
+    quality = _quality;
+    maxSize = tjBufSize(width, height, subsamp);
+
+    handle = tjInitCompress();
+}
+
+
+TurboJpegEncoder::~TurboJpegEncoder()
+{
+    if (handle)
+    {
+        tjDestroy(handle);
+    }
+}
+
+
+bool TurboJpegEncoder::isValid()
+{
+    return(handle != NULL);
+}
+
+
+int TurboJpegEncoder::maxOutputSize()
+{
+    return(maxSize);
+}
+
+
+void TurboJpegEncoder::setQuality(int _quality)
+{
+    quality = _quality;
+}
+
+
+int TurboJpegEncoder::encode(unsigned char* _image, unsigned char* _outBuf)
+{
+    unsigned long   jpgSize = maxSize;
+
+    // TJFLAG_NOREALLOC makes TurboJPEG write into the caller's buffer, which
+    // is guaranteed to be large enough by tjBufSize().
+    if (tjCompress2(handle, _image, width, 0, height, pixelFormat, &_outBuf, &jpgSize, subsamp, quality, TJFLAG_NOREALLOC))
+    {
+        cerr << "TurboJPEG compression failed: " << tjGetErrorStr() << endl;
+        abort();
+    }
+
+    return(jpgSize);
+}
+
+#endif /* HAVE_TURBOJPEG */
@@ -0,0 +1,59 @@
+/*
+ * turbojpegencoder.h
+ *
+ * Author: Andrey Zhdanov
+ * Copyright (C) 2014 BioMag Laboratory, Helsinki University Central Hospital
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TURBOJPEGENCODER_H_
+#define TURBOJPEGENCODER_H_
+
+#ifdef HAVE_TURBOJPEG
+
+#include <turbojpeg.h>
+#include "frameencoder.h"
+
+//! JPEG compressor built on the TurboJPEG API of libjpeg-turbo.
+/*!
+ * Uses the SIMD (SSE2/AVX2) colour conversion and DCT of libjpeg-turbo. The
+ * chroma subsampling matches the libjpeg defaults (4:2:0 for colour), so
+ * the output is interchangeable with that of JpegEncoder.
+ */
+class TurboJpegEncoder : public FrameEncoder
+{
+public:
+    TurboJpegEncoder(int _width, int _height, PixelFormat _format, int _quality);
+    virtual ~TurboJpegEncoder();
+
+    //! Return false if TurboJPEG could not be initialized.
+    bool isValid();
+
+    virtual int maxOutputSize();
+    virtual int encode(unsigned char* _image, unsigned char* _outBuf);
+    virtual void setQuality(int _quality);
+
+private:
+    tjhandle        handle;
+    int             width;
+    int             height;
+    int             pixelFormat;
+    int             subsamp;
+    int             quality;
+    int             maxSize;
+};
+
+#endif /* HAVE_TURBOJPEG */
+
+#endif /* TURBOJPEGENCODER_H_ */
@@ -17,79 +17,101 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <cstdlib>
-#include <stdio.h>
-#include <jpeglib.h>
+#include <time.h>
 
 #include "config.h"
 #include "videocompressorthread.h"
 
-VideoCompressorThread::VideoCompressorThread(CycDataBuffer* _inpBuf, CycDataBuffer* _outBuf, bool _color, int _jpgQuality)
+VideoCompressorThread::VideoCompressorThread(CycDataBuffer* _inpBuf, CycDataBuffer* _outBuf, PixelFormat _format, int _jpgQuality, const QString& _encoderBackend, int _encoderSlices,
+                                             CameraThread* _frameSource, RateController* _rateController)
 {
     inpBuf = _inpBuf;
     outBuf = _outBuf;
-    color = _color;
+    frameSource = _frameSource;
+    format = _format;
     jpgQuality = _jpgQuality;
+    encoder = FrameEncoder::create(_encoderBackend, VIDEO_WIDTH, VIDEO_HEIGHT, format, jpgQuality, _encoderSlices);
+    rateController = _rateController;
+    pool = NULL;
+    streamId = -1;
+}
+
+
+VideoCompressorThread::VideoCompressorThread(CycDataBuffer* _inpBuf, CompressorPool* _pool, int _streamId)
+{
+    inpBuf = _inpBuf;
+    outBuf = NULL;
+    frameSource = NULL;
+    format = PIXEL_FORMAT_MONO8;
+    jpgQuality = 0;
+    encoder = NULL;
+    rateController = NULL;
+    pool = _pool;
+    streamId = _streamId;
 }
 
 
 VideoCompressorThread::~VideoCompressorThread()
 {
+    delete encoder;
 }
 
 
 void VideoCompressorThread::stoppableRun()
 {
-    while(!shouldStop)
+    unsigned char*          data;
+    ChunkAttrib             chunkAttrib;
+    dc1394video_frame_t*    frame;
+    int                     jpgSize;
+    struct timespec         encodeStart;
+    struct timespec         encodeEnd;
+
+    // Dispatcher mode: the pool does the compression
+    if (pool)
     {
-        // JPEG-related stuff
-        struct jpeg_compress_struct cinfo;
-        struct jpeg_error_mgr       jerr;
-        JSAMPROW                    row_pointer;
-        unsigned char*              jpgBuf=NULL;
-        unsigned long               jpgBufLen=0;
-
-        unsigned char*              data;
-        ChunkAttrib                 chunkAttrib;
+        while(!shouldStop)
+        {
+            data = inpBuf->acquireChunk(&chunkAttrib);
+            pool->submit(streamId, data, chunkAttrib);
+        }
+        return;
+    }
 
+    while(!shouldStop)
+    {
         // Get raw image from the input buffer
         data = inpBuf->getChunk(&chunkAttrib);
+        frame = NULL;
+        if (frameSource)
+        {
+            // Read the image directly from the DMA buffer
+            frame = CameraThread::chunkToFrame(data);
+            data = frame->image;
+        }
 
-        // Initialize JPEG
-        cinfo.err = jpeg_std_error(&jerr);
-        jpeg_create_compress(&cinfo);
-        jpeg_mem_dest(&cinfo, &jpgBuf, &jpgBufLen);
-
-        // Set the parameters of the output file
-        cinfo.image_width = VIDEO_WIDTH;
-        cinfo.image_height = VIDEO_HEIGHT;
-        cinfo.input_components = (color ? 3 : 1);
-        cinfo.in_color_space = (color ? JCS_RGB : JCS_GRAYSCALE);
-
-        // Use default compression parameters
-        jpeg_set_defaults(&cinfo);
-        jpeg_set_quality(&cinfo, jpgQuality, TRUE);
-
-        // Do the compression
-        jpeg_start_compress(&cinfo, TRUE);
-
-        // write one row at a time
-        while(cinfo.next_scanline < cinfo.image_height)
+        if (rateController && rateController->getQuality() != jpgQuality)
         {
-            row_pointer = (data + (cinfo.next_scanline * cinfo.image_width * (color ? 3 : 1)));
-            jpeg_write_scanlines(&cinfo, &row_pointer, 1);
+            jpgQuality = rateController->getQuality();
+            encoder->setQuality(jpgQuality);
         }
 
-        // clean up after we're done compressing
-        jpeg_finish_compress(&cinfo);
+        // Compress straight into the output buffer
+        clock_gettime(CLOCK_MONOTONIC, &encodeStart);
+        jpgSize = encoder->encode(data, outBuf->reserveChunk(encoder->maxOutputSize()));
+        clock_gettime(CLOCK_MONOTONIC, &encodeEnd);
 
+        if (frame)
+        {
+            frameSource->releaseFrame(frame);
+        }
 
-        // Insert compressed image into the output buffer
-        chunkAttrib.chunkSize = jpgBufLen;
-        outBuf->insertChunk(jpgBuf, chunkAttrib);
+        // Publish the compressed image in the output buffer
+        outBuf->commitChunk(jpgSize, chunkAttrib);
 
-        // The output buffer needs to be explicitly freed by the libjpeg client
-        free(jpgBuf);
-        jpeg_destroy_compress(&cinfo);
+        if (rateController)
+        {
+            rateController->frameDone(chunkAttrib.timestamp, (encodeEnd.tv_sec - encodeStart.tv_sec) * 1000000 +
+                                      (encodeEnd.tv_nsec - encodeStart.tv_nsec) / 1000, jpgQuality);
+        }
     }
 }
@@ -22,11 +22,29 @@
 
 #include "stoppablethread.h"
 #include "cycdatabuffer.h"
+#include "camerathread.h"
+#include "frameencoder.h"
+#include "compressorpool.h"
+#include "ratecontroller.h"
 
+//! Compresses raw frames from the input buffer to JPEG.
+/*!
+ * If _frameSource is not NULL, the input buffer is assumed to be filled by
+ * _frameSource in zero-copy mode: the chunks reference DMA frames that are
+ * compressed in place and released back to the camera afterwards. If
+ * _rateController is not NULL, it sets the quality of the frames instead of
+ * _jpgQuality.
+ *
+ * When constructed with a CompressorPool, the thread does not compress
+ * anything itself but acts as a dispatcher, handing the raw frames of its
+ * stream to the pool.
+ */
 class VideoCompressorThread : public StoppableThread
 {
 public:
-    VideoCompressorThread(CycDataBuffer* _inpBuf, CycDataBuffer* _outBuf, bool _color, int _jpgQuality);
+    VideoCompressorThread(CycDataBuffer* _inpBuf, CycDataBuffer* _outBuf, PixelFormat _format, int _jpgQuality, const QString& _encoderBackend, int _encoderSlices,
+                          CameraThread* _frameSource=NULL, RateController* _rateController=NULL);
+    VideoCompressorThread(CycDataBuffer* _inpBuf, CompressorPool* _pool, int _streamId);
     virtual ~VideoCompressorThread();
 
 protected:
@@ -35,8 +53,13 @@ protected:
 private:
     CycDataBuffer*  inpBuf;
     CycDataBuffer*  outBuf;
-    bool            color;
+    CameraThread*   frameSource;
+    PixelFormat     format;
     int             jpgQuality;
+    FrameEncoder*   encoder;
+    RateController* rateController;
+    CompressorPool* pool;
+    int             streamId;
 };
 
 #endif /* VIDEOCOMPRESSORTHREAD_H_ */
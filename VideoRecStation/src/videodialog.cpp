@@ -18,6 +18,7 @@
  */
 
 
+#include <string.h>
 #include <iostream>
 
 #include "videodialog.h"
@@ -26,13 +27,20 @@
 
 using namespace std;
 
-VideoDialog::VideoDialog(dc1394camera_t* _camera, int _cameraIdx, QWidget *parent)
+VideoDialog::VideoDialog(dc1394camera_t* _camera, int _cameraIdx, RecordingEpoch* _epoch, CompressorPool* _pool, BufferArena* _arena, IoEngine* _ioEngine, QWidget *parent)
     : QDialog(parent)
 {
-    Settings    settings;
+    Settings        settings;
+    int             codec;
+    int             quality;
+    OverflowPolicy  rawOverflowPolicy;
+    uint64_t        rawSize;
+    uint64_t        compressedSize;
+
     cameraIdx = _cameraIdx;
     prevFrameTstamp = 0;
-    frameCnt = 0;
+    prevFrameSeq = 0;
+    memset(&fpsCursor, 0, sizeof(fpsCursor));
 
     ui.setupUi(this);
     ui.videoWidget->setAlignment(Qt::AlignHCenter | Qt::AlignVCenter);
@@ -41,14 +49,71 @@ VideoDialog::VideoDialog(dc1394camera_t* _camera, int _cameraIdx, QWidget *paren
     camera = _camera;
 
     // Set up video recording
-    cycVideoBufRaw = new CycDataBuffer(CIRC_VIDEO_BUFF_SZ);
-    cycVideoBufJpeg = new CycDataBuffer(CIRC_VIDEO_BUFF_SZ);
-    cameraThread = new CameraThread(camera, cycVideoBufRaw, settings.color);
-    videoFileWriter = new VideoFileWriter(cycVideoBufJpeg, settings.storagePath.toLocal8Bit().data(), cameraIdx + 1);
-    videoCompressorThread = new VideoCompressorThread(cycVideoBufRaw, cycVideoBufJpeg, settings.color, settings.jpgQuality);
+    ringSizes(settings, settings.zeroCopyCapture && camera, &rawSize, &compressedSize);
+    if (_arena)
+    {
+        cycVideoBufRaw = new CycDataBuffer(_arena, rawSize);
+        cycVideoBufJpeg = new CycDataBuffer(_arena, compressedSize);
+    }
+    else
+    {
+        cycVideoBufRaw = new CycDataBuffer(rawSize, settings.bufferHugePages, settings.lockBuffers);
+        cycVideoBufJpeg = new CycDataBuffer(compressedSize, settings.bufferHugePages, settings.lockBuffers);
+    }
+    cameraThread = new CameraThread(camera, cycVideoBufRaw, settings.pixelFormat, settings.dmaBuffers, settings.zeroCopyCapture);
 
-    QObject::connect(cycVideoBufJpeg, SIGNAL(chunkReady(unsigned char*)), ui.videoWidget, SLOT(onDrawFrame(unsigned char*)));
-    QObject::connect(cycVideoBufJpeg, SIGNAL(chunkReady(unsigned char*)), this, SLOT(onNewFrame(unsigned char*)));
+    // In zero-copy mode the raw chunks reference DMA buffers, they can be
+    // neither spilled nor dropped by the consumer
+    rawOverflowPolicy = settings.rawOverflowPolicy;
+    if (cameraThread->isZeroCopy() && (rawOverflowPolicy == OVERFLOW_CATCH_UP || rawOverflowPolicy == OVERFLOW_SPILL))
+    {
+        cerr << "Overflow policy " << settings.rawOverflowMode.toLocal8Bit().data() << " is not supported with zero-copy capture, using drop_newest" << endl;
+        rawOverflowPolicy = OVERFLOW_DROP_NEWEST;
+    }
+    cycVideoBufRaw->setOverflowPolicy(rawOverflowPolicy, QString("camera_%1_raw").arg(cameraIdx + 1).toLocal8Bit().data(),
+                                      settings.overflowTimeout, settings.overflowSpillPath.toLocal8Bit().data());
+    cycVideoBufJpeg->setRecordingEpoch(_epoch);
+    cycVideoBufJpeg->setOverflowPolicy(settings.overflowPolicy, QString("camera_%1").arg(cameraIdx + 1).toLocal8Bit().data(),
+                                       settings.overflowTimeout, settings.overflowSpillPath.toLocal8Bit().data());
+    codec = FrameEncoder::codecId(settings.encoderBackend);
+    quality = (codec == VIDEO_CODEC_JPEG ? settings.jpgQuality : settings.losslessLevel);
+    videoFileWriter = new VideoFileWriter(cycVideoBufJpeg, settings.storagePath.toLocal8Bit().data(), cameraIdx + 1, codec);
+    videoFileWriter->setPreRoll(settings.preRoll * 1000);
+    videoFileWriter->setIoEngine(_ioEngine);
+    videoFileWriter->setDirectIo(settings.directIo);
+    videoFileWriter->setWriteback(uint64_t(settings.fileExtentSize) << 20, uint64_t(settings.dirtyWindow) << 20);
+    videoFileWriter->setWriteIndex(settings.writeIndex);
+    compressorPool = _pool;
+
+    // Rate control only applies to JPEG
+    if (settings.rateControl && codec == VIDEO_CODEC_JPEG)
+    {
+        rateController = new RateController(cameraIdx, cycVideoBufJpeg, videoFileWriter, settings.jpgQuality,
+                                            settings.jpgQualityMin, settings.jpgQualityMax,
+                                            compressorPool ? settings.compressorThreads : 1);
+    }
+    else
+    {
+        rateController = NULL;
+    }
+
+    if (compressorPool)
+    {
+        poolStreamId = compressorPool->addStream(cycVideoBufRaw, cycVideoBufJpeg, settings.pixelFormat, quality,
+                                                 cameraThread->isZeroCopy() ? cameraThread : NULL, rateController);
+        videoCompressorThread = new VideoCompressorThread(cycVideoBufRaw, compressorPool, poolStreamId);
+    }
+    else
+    {
+        poolStreamId = -1;
+        videoCompressorThread = new VideoCompressorThread(cycVideoBufRaw, cycVideoBufJpeg, settings.pixelFormat, quality, settings.encoderBackend, settings.encoderSlices,
+                                                          cameraThread->isZeroCopy() ? cameraThread : NULL, rateController);
+    }
+
+    ui.videoWidget->setCodec(codec);
+    ui.videoWidget->setSource(cycVideoBufJpeg);
+    QObject::connect(cycVideoBufJpeg, SIGNAL(chunkReady(unsigned char*)), ui.videoWidget, SLOT(onDrawFrame()));
+    QObject::connect(cycVideoBufJpeg, SIGNAL(chunkReady(unsigned char*)), this, SLOT(onNewFrame()));
 
     // Setup gain/shutter sliders
     ui.shutterSlider->setMinimum(SHUTTER_MIN_VAL);
@@ -78,11 +143,50 @@ VideoDialog::VideoDialog(dc1394camera_t* _camera, int _cameraIdx, QWidget *paren
 
 VideoDialog::~VideoDialog()
 {
+    clog << "Camera " << cameraIdx + 1 << ": " << ui.videoWidget->missedFrames() << " frames not displayed" << endl;
+
     delete cycVideoBufRaw;
     delete cycVideoBufJpeg;
     delete cameraThread;
     delete videoFileWriter;
     delete videoCompressorThread;
+    delete rateController;
+}
+
+
+void VideoDialog::ringSizes(const Settings& _settings, bool _zeroCopy, uint64_t* _rawSize, uint64_t* _compressedSize)
+{
+    int             frameSize = VIDEO_HEIGHT * rawRowSize(_settings.pixelFormat, VIDEO_WIDTH);
+    int             codec = FrameEncoder::codecId(_settings.encoderBackend);
+    double          rateFraction = (codec == VIDEO_CODEC_JPEG ? JPEG_RATE_FRACTION : LOSSLESS_RATE_FRACTION);
+    FrameEncoder*   probe;
+    int             maxOutputSize;
+
+    // In zero-copy mode the raw buffer only holds pointers to the DMA buffers
+    if (_zeroCopy)
+    {
+        *_rawSize = BufferArena::ringSize(double(sizeof(dc1394video_frame_t*)) * VIDEO_FRAME_RATE, sizeof(dc1394video_frame_t*), _settings.bufferLatency);
+    }
+    else
+    {
+        *_rawSize = BufferArena::ringSize(double(frameSize) * VIDEO_FRAME_RATE, frameSize, _settings.bufferLatency);
+    }
+
+    // The compressors reserve space for the largest possible output
+    probe = FrameEncoder::create(_settings.encoderBackend, VIDEO_WIDTH, VIDEO_HEIGHT, _settings.pixelFormat,
+                                 codec == VIDEO_CODEC_JPEG ? _settings.jpgQuality : _settings.losslessLevel);
+    maxOutputSize = probe->maxOutputSize();
+    delete probe;
+    *_compressedSize = BufferArena::ringSize(frameSize * rateFraction * VIDEO_FRAME_RATE, maxOutputSize,
+                                             _settings.bufferLatency + _settings.preRoll / PRE_ROLL_MAX_LEVEL);
+
+    // The compressor pool reserves space for all the frames in flight. As
+    // the reserved chunks are committed in order, the space taken by them
+    // can be up to twice the total.
+    if (_settings.compressorThreads > 0)
+    {
+        *_compressedSize += uint64_t(2 * POOL_TASKS_PER_STREAM) * (maxOutputSize + CycDataBuffer::chunkOverhead());
+    }
 }
 
 
@@ -93,6 +197,10 @@ void VideoDialog::stopThreads()
     // order of stopping the threads is important.
     videoFileWriter->stop();
     videoCompressorThread->stop();
+    if (compressorPool)
+    {
+        compressorPool->removeStream(poolStreamId);
+    }
     cameraThread->stop();
 }
 
@@ -175,33 +283,32 @@ void VideoDialog::onVRChanged(int _newVal)
 }
 
 
-void VideoDialog::onNewFrame(unsigned char* _jpegBuf)
+void VideoDialog::onNewFrame()
 {
     ChunkAttrib chunkAttrib;
     float       fps;
 
-    chunkAttrib = *((ChunkAttrib*)(_jpegBuf-sizeof(ChunkAttrib)));
+    // Only the timestamp of the newest frame is needed
+    if (!cycVideoBufJpeg->readChunk(&fpsCursor, &chunkAttrib, true))
+    {
+        return;
+    }
 
     if (prevFrameTstamp)
     {
-        if(frameCnt == 10)
+        if(fpsCursor.nextSeq - prevFrameSeq < 10)
         {
-            fps = 1 / (float(chunkAttrib.timestamp - prevFrameTstamp) / 1000);
-            ui.fpsLabel->setText(QString("FPS: %1").arg(fps, 0, 'f', 2));
-            frameCnt = 0;
+            return;
         }
+        fps = (fpsCursor.nextSeq - prevFrameSeq) / (float(chunkAttrib.timestamp - prevFrameTstamp) / 1000);
+        ui.fpsLabel->setText(QString("FPS: %1").arg(fps, 0, 'f', 2));
     }
 
     prevFrameTstamp = chunkAttrib.timestamp;
-    frameCnt++;
+    prevFrameSeq = fpsCursor.nextSeq;
 }
 
 
-void VideoDialog::setIsRec(bool _isRec)
-{
-    cycVideoBufJpeg->setIsRec(_isRec);
-}
-
 void VideoDialog::onLdsBoxToggled(bool _checked)
 {
     ui.videoWidget->limitDisplaySize = _checked;
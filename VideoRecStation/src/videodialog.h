@@ -27,6 +27,12 @@
 #include "cycdatabuffer.h"
 #include "videofilewriter.h"
 #include "videocompressorthread.h"
+#include "compressorpool.h"
+#include "ratecontroller.h"
+#include "bufferarena.h"
+#include "ioengine.h"
+#include "recordingepoch.h"
+#include "settings.h"
 
 
 class VideoDialog : public QDialog
@@ -34,16 +40,25 @@ class VideoDialog : public QDialog
     Q_OBJECT
 
 public:
-    VideoDialog(dc1394camera_t* _camera, int _cameraId, QWidget *parent = 0);
+    /*!
+     * If _pool is not NULL, the frames are compressed by the shared pool.
+     * If _arena is not NULL, the circular buffers of the camera are taken
+     * from the arena. The frames are recorded according to _epoch. If
+     * _ioEngine is not NULL, the files are written through it.
+     */
+    VideoDialog(dc1394camera_t* _camera, int _cameraId, RecordingEpoch* _epoch, CompressorPool* _pool = NULL, BufferArena* _arena = NULL,
+                IoEngine* _ioEngine = NULL, QWidget *parent = 0);
     virtual ~VideoDialog();
-    void setIsRec(bool _isRec);
+
+    //! Sizes of the raw and compressed video buffers of a camera in bytes.
+    static void ringSizes(const Settings& _settings, bool _zeroCopy, uint64_t* _rawSize, uint64_t* _compressedSize);
 
 public slots:
     void onShutterChanged(int _newVal);
     void onGainChanged(int _newVal);
     void onUVChanged(int _newVal);
     void onVRChanged(int _newVal);
-    void onNewFrame(unsigned char* _jpegBuf);
+    void onNewFrame();
     void onLdsBoxToggled(bool _checked);
 
     //! Stop all the threads associated with the dialog.
@@ -64,10 +79,14 @@ private:
     CycDataBuffer*          cycVideoBufJpeg;
     VideoFileWriter*        videoFileWriter;
     VideoCompressorThread*  videoCompressorThread;
+    RateController*         rateController;
+    CompressorPool*         compressorPool;
+    int                     poolStreamId;
 
     // These variables are used for showing the FPS
+    ChunkCursor             fpsCursor;
     u_int64_t               prevFrameTstamp;
-    int                     frameCnt;
+    uint64_t                prevFrameSeq;
 };
 
 #endif // VIDEODIALOG_H
@@ -27,12 +27,13 @@
 using namespace std;
 
 
-VideoFileWriter::VideoFileWriter(CycDataBuffer* _cycBuf, const char* _path, int _camId)
+VideoFileWriter::VideoFileWriter(CycDataBuffer* _cycBuf, const char* _path, int _camId, int _codec)
     :   FileWriter(_cycBuf, _path, "_video", "vid", _camId)
 {
-    uint32_t ver = VIDEO_FILE_VERSION;
+    uint32_t ver = (_codec == VIDEO_CODEC_JPEG ? VIDEO_FILE_VERSION : VIDEO_FILE_VERSION_CODEC);
+    uint32_t codec = _codec;
 
-    bufLen = strlen(MAGIC_VIDEO_STR) + sizeof(uint32_t);
+    bufLen = strlen(MAGIC_VIDEO_STR) + sizeof(uint32_t) + (_codec == VIDEO_CODEC_JPEG ? 0 : sizeof(uint32_t));
     buf = (unsigned char*)malloc(bufLen);
 
     if(!buf)
@@ -43,6 +44,10 @@ VideoFileWriter::VideoFileWriter(CycDataBuffer* _cycBuf, const char* _path, int
 
     memcpy(buf, MAGIC_VIDEO_STR, strlen(MAGIC_VIDEO_STR));          // string identifying the file type
     memcpy(buf + strlen(MAGIC_VIDEO_STR), &ver, sizeof(uint32_t));  // version of file format
+    if (_codec != VIDEO_CODEC_JPEG)
+    {
+        memcpy(buf + strlen(MAGIC_VIDEO_STR) + sizeof(uint32_t), &codec, sizeof(uint32_t));    // codec of the chunks
+    }
 }
 
 
@@ -20,12 +20,19 @@
 #ifndef VIDEOFILEWRITER_H_
 #define VIDEOFILEWRITER_H_
 
+#include "common.h"
 #include "filewriter.h"
 
+//! Writes compressed video frames to a file.
+/*!
+ * JPEG video is written in the version 2 format. Other codecs use version
+ * VIDEO_FILE_VERSION_CODEC, which adds the codec tag (uint32, VIDEO_CODEC_*)
+ * after the version.
+ */
 class VideoFileWriter : public FileWriter
 {
 public:
-    VideoFileWriter(CycDataBuffer* _cycBuf, const char* _path, int _camId);
+    VideoFileWriter(CycDataBuffer* _cycBuf, const char* _path, int _camId, int _codec=VIDEO_CODEC_JPEG);
     virtual ~VideoFileWriter();
 
 protected:
@@ -19,6 +19,8 @@
 
 #include <iostream>
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
 #include <QObject>
 
 #include "config.h"
@@ -33,12 +35,128 @@ VideoWidget::VideoWidget(QWidget* parent)
 {
     rotate = false;
     limitDisplaySize = false;
+    decoder = NULL;
+    rgbBuf = NULL;
+    source = NULL;
+    memset(&cursor, 0, sizeof(cursor));
+
+    for (int i=0; i<256; i++)
+    {
+        grayTable.append(qRgb(i, i, i));
+    }
+}
+
+
+VideoWidget::~VideoWidget()
+{
+    delete decoder;
+    free(rgbBuf);
+}
+
+
+void VideoWidget::setCodec(int _codec)
+{
+    delete decoder;
+    decoder = (_codec == VIDEO_CODEC_JPEG ? NULL : new LosslessDecoder(_codec));
+}
+
+
+void VideoWidget::setSource(CycDataBuffer* _source)
+{
+    source = _source;
+    memset(&cursor, 0, sizeof(cursor));
+}
+
+
+uint64_t VideoWidget::missedFrames()
+{
+    return(cursor.missed);
+}
+
+
+static unsigned char clip(int _val)
+{
+    return(_val < 0 ? 0 : (_val > 255 ? 255 : _val));
+}
+
+
+QImage VideoWidget::rawToImage(unsigned char* _frame, int _width, int _height, PixelFormat _format)
+{
+    QImage          image;
+    int             chromaFactor;
+    int             rowSize = rawRowSize(_format, _width);
+    unsigned char*  src;
+    unsigned char*  dst;
+    int             y;
+    int             u;
+    int             v;
+
+    switch (_format)
+    {
+    case PIXEL_FORMAT_MONO8:
+        image = QImage(_frame, _width, _height, rowSize, QImage::Format_Indexed8);
+        image.setColorTable(grayTable);
+        return(image);
+
+    case PIXEL_FORMAT_RGB8:
+        return(QImage(_frame, _width, _height, rowSize, QImage::Format_RGB888));
+
+    default:
+        break;
+    }
+
+    // YUV (ITU-R BT.601) to RGB
+    if (!rgbBuf)
+    {
+        rgbBuf = (unsigned char*)malloc(VIDEO_WIDTH * VIDEO_HEIGHT * 3);
+        if (!rgbBuf)
+        {
+            cerr << "Cannot allocate memory!" << endl;
+            abort();
+        }
+    }
+    if (_width * _height > VIDEO_WIDTH * VIDEO_HEIGHT)
+    {
+        return(QImage());
+    }
+
+    chromaFactor = (_format == PIXEL_FORMAT_YUV422 ? 2 : 4);
+    for (int i=0; i<_height; i++)
+    {
+        src = _frame + i * rowSize;
+        dst = rgbBuf + i * _width * 3;
+        for (int j=0; j<_width; j++)
+        {
+            // U Y V Y or U Y Y V Y Y
+            int group = j / chromaFactor;
+            int k = j % chromaFactor;
+            unsigned char* g = src + group * (chromaFactor + 2);
+
+            u = g[0] - 128;
+            v = g[chromaFactor == 2 ? 2 : 3] - 128;
+            if (chromaFactor == 2)
+            {
+                y = g[1 + 2 * k];
+            }
+            else
+            {
+                y = g[k < 2 ? 1 + k : 2 + k];
+            }
+
+            *(dst++) = clip(y + ((359 * v) >> 8));
+            *(dst++) = clip(y - ((88 * u + 183 * v) >> 8));
+            *(dst++) = clip(y + ((454 * u) >> 8));
+        }
+    }
+
+    return(QImage(rgbBuf, _width, _height, _width * 3, QImage::Format_RGB888));
 }
 
 
-void VideoWidget::onDrawFrame(unsigned char* _jpegBuf)
+void VideoWidget::onDrawFrame()
 {
-    ChunkAttrib chunkAttrib;
+    ChunkAttrib     chunkAttrib;
+    unsigned char*  jpegBuf;
     QPixmap     pixMap;
     QTransform  transform;
     QTransform  trans = transform.rotate(rotate ? 180 : 0);
@@ -50,9 +168,37 @@ void VideoWidget::onDrawFrame(unsigned char* _jpegBuf)
         width = min(width, VIDEO_WIDTH);
         height = min(height, VIDEO_HEIGHT);
     }
-    chunkAttrib = *((ChunkAttrib*)(_jpegBuf-sizeof(ChunkAttrib)));
 
-    pixMap.loadFromData(_jpegBuf, chunkAttrib.chunkSize);
+    // If the GUI is lagging behind, skip straight to the newest frame
+    jpegBuf = source ? source->readChunk(&cursor, &chunkAttrib, true) : NULL;
+    if (!jpegBuf)
+    {
+        return;
+    }
+
+    if (decoder)
+    {
+        int             frameWidth;
+        int             frameHeight;
+        PixelFormat     format;
+        unsigned char*  frame = decoder->decode(jpegBuf, chunkAttrib.chunkSize, &frameWidth, &frameHeight, &format);
+
+        if (!frame)
+        {
+            return;
+        }
+        pixMap = QPixmap::fromImage(rawToImage(frame, frameWidth, frameHeight, format));
+    }
+    else
+    {
+        pixMap.loadFromData(jpegBuf, chunkAttrib.chunkSize);
+    }
+
+    // Drop the frame if it was overwritten while being decoded
+    if (!source->chunkIntact(&cursor))
+    {
+        return;
+    }
 
     // before displaying, scale the pixmap to preserve the aspect ratio
     this->setPixmap(pixMap.scaled(width, height, Qt::KeepAspectRatio).transformed(trans));
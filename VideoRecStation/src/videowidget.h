@@ -21,6 +21,12 @@
 #define VIDEOWIDGET_H_
 
 #include <QLabel>
+#include <QImage>
+#include <QVector>
+#include <QRgb>
+
+#include "losslessdecoder.h"
+#include "cycdatabuffer.h"
 
 class VideoWidget : public QLabel
 {
@@ -28,15 +34,35 @@ class VideoWidget : public QLabel
 
 public:
     VideoWidget(QWidget* parent=0);
+    virtual ~VideoWidget();
     //int heightForWidth(int _w);
+
+    //! Set the codec (VIDEO_CODEC_*) of the frames to be drawn. JPEG by default.
+    void setCodec(int _codec);
+
+    //! Set the buffer the frames are read from.
+    void setSource(CycDataBuffer* _source);
+
+    //! Number of frames skipped or dropped because they were overwritten while being decoded.
+    uint64_t missedFrames();
+
     volatile bool rotate;
     volatile bool limitDisplaySize;
 
 public slots:
-    void onDrawFrame(unsigned char* _jpegBuf);
+    //! Draw the newest frame in the source buffer.
+    void onDrawFrame();
 
 private:
-    char*       imBuf;
+    //! Convert a raw frame decompressed by the lossless decoder to an image.
+    QImage rawToImage(unsigned char* _frame, int _width, int _height, PixelFormat _format);
+
+    char*               imBuf;
+    CycDataBuffer*      source;
+    ChunkCursor         cursor;
+    LosslessDecoder*    decoder;        // NULL for JPEG
+    QVector<QRgb>       grayTable;
+    unsigned char*      rgbBuf;         // for YUV frames
 };
 
 #endif /* VIDEOWIDGET_H_ */